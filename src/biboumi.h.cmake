@@ -3,6 +3,8 @@
 #cmakedefine LIBIDN_FOUND
 #cmakedefine SYSTEMD_FOUND
 #cmakedefine POLLER ${POLLER}
+#cmakedefine EPOLL_EDGE_TRIGGERED
+#cmakedefine TIMERFD_FOUND
 #cmakedefine BOTAN_FOUND
 #cmakedefine GCRYPT_FOUND
 #cmakedefine UDNS_FOUND
@@ -13,6 +13,7 @@
 #include <database/database.hpp>
 #include "result_set_management.hpp"
 #include <algorithm>
+#include <cstring>
 
 using namespace std::string_literals;
 
@@ -139,6 +140,8 @@ IrcClient* Bridge::make_irc_client(const std::string& hostname, const std::strin
                                                             realname, jid.domain,
                                                             *this));
       std::unique_ptr<IrcClient>& irc = this->irc_clients.at(hostname);
+      if (this->xmpp.is_above_output_high_watermark())
+        irc->pause_recv();
       return irc.get();
     }
 }
@@ -239,15 +242,14 @@ void Bridge::send_channel_message(const Iid& iid, const std::string& body, std::
         if ((line.size() > strlen("\01ACTION\01")) &&
             (line.substr(0, 7) == "\01ACTION") && line[line.size() - 1] == '\01')
           line = "/me " + line.substr(8, line.size() - 9);
-        for (const auto& resource: this->resources_in_chan[iid.to_tuple()])
-          {
-            auto stanza = this->xmpp.make_muc_message(std::to_string(iid), irc->get_own_nick(), this->make_xmpp_body(line),
-                                                       this->user_jid + "/"
-                                                       + resource, uuid, id);
-            for (const auto& node: nodes_to_reflect)
-              stanza.add_child(node);
-            this->xmpp.send_stanza(stanza);
-          }
+        const auto jids = this->get_jids_in_chan(iid);
+        if (jids.empty())
+          return;
+        auto stanza = this->xmpp.make_muc_message(std::to_string(iid), irc->get_own_nick(), this->make_xmpp_body(line),
+                                                   "", uuid, id);
+        for (const auto& node: nodes_to_reflect)
+          stanza.add_child(node);
+        this->xmpp.send_stanza_to_all(stanza, jids);
       };
 
       if (line.substr(0, 5) == "/mode")
@@ -851,21 +853,17 @@ void Bridge::send_message(const Iid& iid, const std::string& nick, const std::st
   std::string uuid{};
   if (muc)
     {
+      auto xmpp_body = this->make_xmpp_body(body, encoding);
 #ifdef USE_DATABASE
-      const auto xmpp_body = this->make_xmpp_body(body, encoding);
       if (log && this->record_history)
         uuid = Database::store_muc_message(this->get_bare_jid(), iid.get_local(), iid.get_server(), std::chrono::system_clock::now(),
                                            std::get<0>(xmpp_body), nick);
 #else
       (void)log;
 #endif
-      for (const auto& resource: this->resources_in_chan[iid.to_tuple()])
-        {
-          auto stanza = this->xmpp.make_muc_message(std::to_string(iid), nick, this->make_xmpp_body(body, encoding),
-                                                     this->user_jid + "/"
-                                                     + resource, uuid, utils::gen_uuid());
-          this->xmpp.send_stanza(stanza);
-        }
+      auto stanza = this->xmpp.make_muc_message(std::to_string(iid), nick, std::move(xmpp_body),
+                                                 "", uuid, utils::gen_uuid());
+      this->xmpp.send_stanza_to_all(stanza, this->get_jids_in_chan(iid));
     }
   else
     {
@@ -1226,6 +1224,25 @@ std::size_t Bridge::number_of_resources_in_chan(const Bridge::ChannelKey& channe
   return it->second.size();
 }
 
+std::size_t Bridge::number_of_resources_in_server(const Bridge::IrcHostname& irc_hostname) const
+{
+  auto it = this->resources_in_server.find(irc_hostname);
+  if (it == this->resources_in_server.end())
+    return 0;
+  return it->second.size();
+}
+
+std::vector<std::string> Bridge::get_jids_in_chan(const Iid& iid) const
+{
+  std::vector<std::string> res;
+  auto it = this->resources_in_chan.find(iid.to_tuple());
+  if (it == this->resources_in_chan.end())
+    return res;
+  for (const auto& resource: it->second)
+    res.push_back(this->user_jid + "/" + resource);
+  return res;
+}
+
 std::size_t Bridge::number_of_channels_the_resource_is_in(const std::string& irc_hostname, const std::string& resource) const
 {
   std::size_t res = 0;
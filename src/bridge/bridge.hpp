@@ -295,9 +295,17 @@ private:
   void remove_resource_from_chan(const ChannelKey& channel, const std::string& resource);
 public:
   bool is_resource_in_chan(const ChannelKey& channel, const std::string& resource) const;
+  /**
+   * The number of our resources (online, and in a channel) on that server
+   */
+  std::size_t number_of_resources_in_server(const IrcHostname& irc_hostname) const;
 private:
   void remove_all_resources_from_chan(const ChannelKey& channel);
   std::size_t number_of_resources_in_chan(const ChannelKey& channel) const;
+  /**
+   * The full JIDs of all our resources in that channel
+   */
+  std::vector<std::string> get_jids_in_chan(const Iid& iid) const;
 
   void add_resource_to_server(const IrcHostname& irc_hostname, const std::string& resource);
   void remove_resource_from_server(const IrcHostname& irc_hostname, const std::string& resource);
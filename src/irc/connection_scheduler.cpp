@@ -0,0 +1,156 @@
+#include <irc/connection_scheduler.hpp>
+#include <utils/timed_events.hpp>
+#include <config/config.hpp>
+#include <logger/logger.hpp>
+
+#include <algorithm>
+#include <random>
+
+/**
+ * A random delay between 0 and max, so that the connections queued at the
+ * same time are not started in lockstep.
+ */
+static std::chrono::milliseconds jitter(const int max)
+{
+  static std::mt19937 generator{std::random_device{}()};
+  if (max <= 0)
+    return 0ms;
+  std::uniform_int_distribution<int> distribution(0, max);
+  return std::chrono::milliseconds(distribution(generator));
+}
+
+ConnectionScheduler& ConnectionScheduler::instance()
+{
+  static ConnectionScheduler inst;
+  return inst;
+}
+
+void ConnectionScheduler::schedule(const std::string& server, const void* id, const bool priority, Callback callback)
+{
+  auto& queue = this->servers[server];
+  queue.in_progress.erase(id);
+  if (priority)
+    queue.priority_queue.push_back({id, std::move(callback)});
+  else
+    queue.queue.push_back({id, std::move(callback)});
+  this->process(server);
+}
+
+void ConnectionScheduler::finished(const std::string& server, const void* id)
+{
+  auto it = this->servers.find(server);
+  if (it == this->servers.end())
+    return;
+  auto& queue = it->second;
+  const auto has_id = [id](const Waiting& waiting) { return waiting.id == id; };
+  queue.priority_queue.erase(std::remove_if(queue.priority_queue.begin(), queue.priority_queue.end(), has_id),
+                             queue.priority_queue.end());
+  queue.queue.erase(std::remove_if(queue.queue.begin(), queue.queue.end(), has_id),
+                    queue.queue.end());
+  queue.in_progress.erase(id);
+  this->process(server);
+}
+
+bool ConnectionScheduler::is_queued(const std::string& server, const void* id) const
+{
+  auto it = this->servers.find(server);
+  if (it == this->servers.end())
+    return false;
+  const auto has_id = [id](const Waiting& waiting) { return waiting.id == id; };
+  const auto& queue = it->second;
+  return std::any_of(queue.priority_queue.begin(), queue.priority_queue.end(), has_id) ||
+      std::any_of(queue.queue.begin(), queue.queue.end(), has_id);
+}
+
+std::size_t ConnectionScheduler::queue_size(const std::string& server) const
+{
+  auto it = this->servers.find(server);
+  if (it == this->servers.end())
+    return 0;
+  return it->second.priority_queue.size() + it->second.queue.size();
+}
+
+std::size_t ConnectionScheduler::queue_size() const
+{
+  std::size_t res = 0;
+  for (const auto& pair: this->servers)
+    res += pair.second.priority_queue.size() + pair.second.queue.size();
+  return res;
+}
+
+std::vector<const void*> ConnectionScheduler::queued(const std::string& server) const
+{
+  std::vector<const void*> res;
+  auto it = this->servers.find(server);
+  if (it == this->servers.end())
+    return res;
+  for (const auto& waiting: it->second.priority_queue)
+    res.push_back(waiting.id);
+  for (const auto& waiting: it->second.queue)
+    res.push_back(waiting.id);
+  return res;
+}
+
+std::size_t ConnectionScheduler::in_progress(const std::string& server) const
+{
+  auto it = this->servers.find(server);
+  if (it == this->servers.end())
+    return 0;
+  return it->second.in_progress.size();
+}
+
+void ConnectionScheduler::process(const std::string& server)
+{
+  const auto max_connecting = Config::get_int("irc_server_max_connecting", 10);
+  const auto interval = Config::get_int("irc_server_connection_interval", 200);
+  while (true)
+    {
+      // The callbacks may call us again, and change anything, so we look
+      // everything up again at each iteration
+      auto it = this->servers.find(server);
+      if (it == this->servers.end())
+        return;
+      auto& queue = it->second;
+      auto& waiting = queue.priority_queue.empty() ? queue.queue : queue.priority_queue;
+      const auto now = std::chrono::steady_clock::now();
+      if (waiting.empty())
+        {
+          // Nothing left to do for this server: forget it, but only once
+          // the next connection would be allowed to start anyway
+          if (queue.in_progress.empty())
+            {
+              if (now < queue.next_start)
+                this->process_later(server, queue.next_start);
+              else
+                this->servers.erase(it);
+            }
+          return;
+        }
+      // We are called again by finished() when a slot becomes available
+      if (max_connecting > 0 && queue.in_progress.size() >= static_cast<std::size_t>(max_connecting))
+        return;
+      if (now < queue.next_start)
+        {
+          this->process_later(server, queue.next_start);
+          return;
+        }
+      auto next = std::move(waiting.front());
+      waiting.pop_front();
+      queue.in_progress.insert(next.id);
+      if (interval > 0)
+        queue.next_start = now + std::chrono::milliseconds(interval) + jitter(interval / 2);
+      log_debug("Starting a connection to ", server, " (", queue.in_progress.size(),
+                " in progress, ", queue.priority_queue.size() + queue.queue.size(), " waiting)");
+      next.callback();
+    }
+}
+
+void ConnectionScheduler::process_later(const std::string& server, const std::chrono::steady_clock::time_point date)
+{
+  const auto event_name = "ConnectionScheduler" + server;
+  if (!TimedEventsManager::instance().find_event(event_name))
+    TimedEventsManager::instance().add_event(
+        TimedEvent(std::chrono::steady_clock::time_point(date),
+                   [server]() { ConnectionScheduler::instance().process(server); },
+                   event_name));
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <functional>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+
+/**
+ * Decides when the connections to the IRC servers are started, for all
+ * the bridges.
+ *
+ * After a restart, or when the XMPP server reconnects, all the users
+ * connect to the same IRC servers at the same time. To not be throttled
+ * (or banned) by these servers, the connections are queued per server: at
+ * most irc_server_max_connecting of them are in progress at the same time,
+ * and two of them are started at least irc_server_connection_interval
+ * milliseconds (plus a random jitter) apart.
+ *
+ * The connections of the users currently using that server (with at least
+ * one online resource in one of its channels) are started before the
+ * others.
+ */
+class ConnectionScheduler
+{
+public:
+  using Callback = std::function<void()>;
+
+  ~ConnectionScheduler() = default;
+  ConnectionScheduler(const ConnectionScheduler&) = delete;
+  ConnectionScheduler(ConnectionScheduler&&) = delete;
+  ConnectionScheduler& operator=(const ConnectionScheduler&) = delete;
+  ConnectionScheduler& operator=(ConnectionScheduler&&) = delete;
+
+  static ConnectionScheduler& instance();
+
+  /**
+   * Queue a connection to the given server, identified by the given id.
+   * The callback is called when the connection can be started, possibly
+   * right away.  It is considered in progress until finished() is called
+   * with the same id.
+   */
+  void schedule(const std::string& server, const void* id, const bool priority, Callback callback);
+  /**
+   * The connection identified by this id is done (successfully or not), or
+   * is not wanted anymore if it is still queued.
+   */
+  void finished(const std::string& server, const void* id);
+  /**
+   * Whether this connection is waiting in the queue.
+   */
+  bool is_queued(const std::string& server, const void* id) const;
+  /**
+   * The number of connections waiting in the queue of the given server,
+   * or of all the servers.
+   */
+  std::size_t queue_size(const std::string& server) const;
+  std::size_t queue_size() const;
+  /**
+   * The ids of the connections waiting in the queue of the given server,
+   * in the order in which they will be started.
+   */
+  std::vector<const void*> queued(const std::string& server) const;
+  /**
+   * The number of connections in progress to the given server.
+   */
+  std::size_t in_progress(const std::string& server) const;
+  /**
+   * The number of servers that we still keep track of: with connections
+   * queued or in progress, or with one started too recently for the next
+   * one to start right away.
+   */
+  std::size_t servers_count() const
+  { return this->servers.size(); }
+
+private:
+  ConnectionScheduler() = default;
+
+  struct Waiting
+  {
+    const void* id;
+    Callback callback;
+  };
+  struct ServerQueue
+  {
+    std::deque<Waiting> priority_queue;
+    std::deque<Waiting> queue;
+    std::set<const void*> in_progress;
+    std::chrono::steady_clock::time_point next_start;
+  };
+  /**
+   * Start as many queued connections to the given server as the limits
+   * allow, and if some are left, make sure we are called again when the
+   * next one can be started.
+   */
+  void process(const std::string& server);
+  /**
+   * Call process() for that server at the given date, unless it is already
+   * planned.
+   */
+  void process_later(const std::string& server, const std::chrono::steady_clock::time_point date);
+
+  std::map<std::string, ServerQueue> servers;
+};
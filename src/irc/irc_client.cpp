@@ -3,6 +3,7 @@
 #include <database/database.hpp>
 #include <irc/irc_message.hpp>
 #include <irc/irc_client.hpp>
+#include <irc/connection_scheduler.hpp>
 #include <bridge/bridge.hpp>
 #include <irc/irc_user.hpp>
 #include <utils/base64.hpp>
@@ -154,15 +155,11 @@ IrcClient::IrcClient(std::shared_ptr<Poller>& poller, std::string hostname,
   current_nick(std::move(nickname)),
   bridge(bridge),
   welcomed(false),
+  connection_scheduled(false),
+  ping_event(0),
   chanmodes({"", "", "", ""}),
   chantypes({'#', '&'}),
-  tokens_bucket(this->get_throttle_limit(), 1s, [this]() {
-    if (message_queue.empty())
-      return true;
-    this->actual_send(std::move(this->message_queue.front()));
-    this->message_queue.pop_front();
-    return false;
-  }, "TokensBucket" + this->hostname + this->bridge.get_jid())
+  tokens_bucket(this->get_throttle_limit(), 1s, [this]() { this->send_queued_messages(); })
 {
 #ifdef USE_DATABASE
   auto options = Database::get_irc_server_options(this->bridge.get_bare_jid(),
@@ -189,8 +186,8 @@ IrcClient::~IrcClient()
 {
   // This event may or may not exist (if we never got connected, it
   // doesn't), but it's ok
-  TimedEventsManager::instance().cancel("PING" + this->hostname + this->bridge.get_jid());
-  TimedEventsManager::instance().cancel("TokensBucket" + this->hostname + this->bridge.get_jid());
+  TimedEventsManager::instance().cancel(this->ping_event);
+  ConnectionScheduler::instance().finished(this->hostname, this);
 }
 
 void IrcClient::start()
@@ -202,6 +199,33 @@ void IrcClient::start()
       this->bridge.send_xmpp_message(this->hostname, "", "Can not connect to IRC server: no port specified.");
       return;
     }
+  // The users actually using this server (with a resource in one of its
+  // channels) go before the ones that are offline
+  const bool priority = this->bridge.number_of_resources_in_server(this->hostname) > 0;
+  this->connection_scheduled = true;
+  ConnectionScheduler::instance().schedule(this->hostname, this, priority,
+                                           [this]()
+                                           {
+                                             this->connection_scheduled = false;
+                                             this->connect_to_server();
+                                           });
+  if (this->connection_scheduled)
+    {
+      const auto queue_size = ConnectionScheduler::instance().queue_size(this->hostname);
+      this->bridge.send_xmpp_message(this->hostname, "", "Waiting to connect to " + this->hostname + ": " +
+                                     std::to_string(queue_size) + " connection" + (queue_size > 1 ? "s are" : " is") +
+                                     " queued for this server.");
+    }
+}
+
+bool IrcClient::is_connecting() const
+{
+  return this->connection_scheduled || TCPClientSocketHandler::is_connecting();
+}
+
+void IrcClient::connect_to_server()
+{
+  const LogContext log_context(this->bridge.get_jid(), this->hostname);
   std::string port;
   bool tls;
   std::tie(port, tls) = this->ports_to_try.top();
@@ -227,6 +251,8 @@ void IrcClient::start()
 
 void IrcClient::on_connection_failed(const std::string& reason)
 {
+  const LogContext log_context(this->bridge.get_jid(), this->hostname);
+  ConnectionScheduler::instance().finished(this->hostname, this);
   this->bridge.send_xmpp_message(this->hostname, "",
                                   "Connection failed: " + reason);
 
@@ -252,6 +278,8 @@ void IrcClient::on_connection_failed(const std::string& reason)
 
 void IrcClient::on_connected()
 {
+  const LogContext log_context(this->bridge.get_jid(), this->hostname);
+  ConnectionScheduler::instance().finished(this->hostname, this);
   const auto webirc_password = Config::get("webirc_password", "");
   static std::string resolved_ip;
 
@@ -340,6 +368,7 @@ void IrcClient::on_connected()
 
 void IrcClient::on_connection_close(const std::string& error_msg)
 {
+  const LogContext log_context(this->bridge.get_jid(), this->hostname);
   std::string message = "Connection closed";
   if (!error_msg.empty())
     message += ": " + error_msg;
@@ -390,9 +419,10 @@ std::string IrcClient::get_own_nick() const
 
 void IrcClient::parse_in_buffer(const size_t)
 {
+  const LogContext log_context(this->bridge.get_jid(), this->hostname);
   while (true)
     {
-      auto pos = this->in_buf.find("\r\n");
+      auto pos = this->in_buf.find("\r\n", 0, 2);
       if (pos == std::string::npos)
         break ;
       IrcMessage message(this->in_buf.substr(0, pos));
@@ -464,10 +494,27 @@ void IrcClient::actual_send(std::pair<IrcMessage, MessageCallback>&& message_pai
 void IrcClient::send_message(IrcMessage message, MessageCallback callback, bool throttle)
 {
   auto message_pair = std::make_pair(std::move(message), std::move(callback));
-  if (this->tokens_bucket.use_token() || !throttle)
+  // The queued messages must be sent first
+  if (!throttle || (this->message_queue.empty() && this->tokens_bucket.use_token()))
     this->actual_send(std::move(message_pair));
   else
-    message_queue.push_back(std::move(message_pair));
+    {
+      message_queue.push_back(std::move(message_pair));
+      this->tokens_bucket.wait_for_token();
+    }
+}
+
+void IrcClient::send_queued_messages()
+{
+  const LogContext log_context(this->bridge.get_jid(), this->hostname);
+  while (!this->message_queue.empty() && this->tokens_bucket.use_token())
+    {
+      auto message_pair = std::move(this->message_queue.front());
+      this->message_queue.pop_front();
+      this->actual_send(std::move(message_pair));
+    }
+  if (!this->message_queue.empty())
+    this->tokens_bucket.wait_for_token();
 }
 
 void IrcClient::send_raw(const std::string& txt)
@@ -518,6 +565,12 @@ void IrcClient::send_topic_command(const std::string& chan_name, const std::stri
 
 void IrcClient::send_quit_command(const std::string& reason)
 {
+  if (this->connection_scheduled)
+    { // Not connected yet, just give up connecting
+      ConnectionScheduler::instance().finished(this->hostname, this);
+      this->connection_scheduled = false;
+      return;
+    }
   this->send_message(IrcMessage("QUIT", {reason}), {}, false);
 }
 
@@ -603,6 +656,7 @@ void IrcClient::on_pong(const IrcMessage&)
 
 void IrcClient::send_ping_command()
 {
+  const LogContext log_context(this->bridge.get_jid(), this->hostname);
   this->send_message(IrcMessage("PING", {"biboumi"}));
 }
 
@@ -984,8 +1038,10 @@ void IrcClient::on_welcome_message(const IrcMessage& message)
     this->send_raw(command.col<Database::AfterConnectionCommand>());
 #endif
   // Install a repeated events to regularly send a PING
-  TimedEventsManager::instance().add_event(TimedEvent(240s, std::bind(&IrcClient::send_ping_command, this),
-                                                      "PING" + this->hostname + this->bridge.get_jid()));
+  TimedEventsManager::instance().cancel(this->ping_event);
+  // It doesn’t need to be precise, so it can be sent along with the others
+  this->ping_event = TimedEventsManager::instance().add_event(TimedEvent(240s, std::bind(&IrcClient::send_ping_command, this),
+                                                                         "", 10s));
   std::string channels{};
   std::string channels_with_key{};
   std::string keys{};
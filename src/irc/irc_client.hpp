@@ -52,9 +52,17 @@ public:
   IrcClient& operator=(IrcClient&&) = delete;
 
   /**
-   * Connect to the IRC server
+   * Connect to the IRC server, as soon as the ConnectionScheduler allows
+   * it.
    */
   void start();
+  /**
+   * Also true while our connection is waiting in the ConnectionScheduler
+   * queue
+   */
+  bool is_connecting() const override final;
+  bool is_connection_scheduled() const
+  { return this->connection_scheduled; }
   /**
    * Called when the connection to the server cannot be established
    */
@@ -99,6 +107,11 @@ public:
   void send_message(IrcMessage message, MessageCallback callback={}, bool throttle=true);
   void send_raw(const std::string& txt);
   void actual_send(std::pair<IrcMessage, MessageCallback>&& message_pair);
+  /**
+   * Send the throttled messages for which we have a token, and wait for
+   * the next token if some are left.
+   */
+  void send_queued_messages();
   /**
    * Send the PONG irc command
    */
@@ -244,6 +257,10 @@ public:
   void on_cap(const IrcMessage& message);
 private:
   void cap_end();
+  /**
+   * Actually connect to the IRC server, using the next port to try.
+   */
+  void connect_to_server();
 public:
 #ifdef WITH_SASL
   void on_authenticate(const IrcMessage& message);
@@ -379,6 +396,14 @@ private:
    * has been established, we are authentified and we have a nick)
    */
   bool welcomed;
+  /**
+   * Whether our connection is waiting in the ConnectionScheduler queue
+   */
+  bool connection_scheduled;
+  /**
+   * The repeated event sending a PING to the server
+   */
+  TimedEventHandle ping_event;
 #ifdef WITH_SASL
   /**
    * Whether or not we are trying to authenticate using sasl. If this is true we need to wait for a
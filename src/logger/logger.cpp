@@ -1,16 +1,27 @@
 #include <logger/logger.hpp>
 #include <config/config.hpp>
+#include <utils/tolower.hpp>
+#include <utils/split.hpp>
+
+#include <algorithm>
+#include <chrono>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+using namespace std::string_literals;
+
+const std::array<const char*, logging_details::other_subsystem> logging_details::subsystem_names{{
+    "network", "irc", "xmpp", "database", "bridge"
+}};
+
 Logger::Logger(const int log_level):
   log_level(log_level),
   stream(std::cout.rdbuf()),
-  null_buffer{},
-  null_stream{&null_buffer}
+  min_level(log_level)
 {
+  this->levels.fill(log_level);
 #ifdef SYSTEMD_FOUND
   if (!this->use_stdout())
     return;
@@ -36,9 +47,84 @@ Logger::Logger(const int log_level, const std::string& log_file):
   log_level(log_level),
   ofstream(log_file.data(), std::ios_base::app),
   stream(ofstream.rdbuf()),
-  null_buffer{},
-  null_stream{&null_buffer}
+  min_level(log_level)
+{
+  this->levels.fill(log_level);
+}
+
+Logger::~Logger()
+{
+  if (this->writer.joinable())
+    {
+      this->stopping.store(true);
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->condition.notify_one();
+      }
+      this->writer.join();
+    }
+}
+
+void Logger::start_async_writer(const std::size_t queue_size)
+{
+#ifdef SYSTEMD_FOUND
+  // sd_journal_send() is already asynchronous enough
+  if (this->use_systemd)
+    return;
+#endif
+  this->queue = std::make_unique<utils::SpscQueue<std::string>>(queue_size);
+  this->writer = std::thread([this]() { this->run_writer(); });
+}
+
+void Logger::write_async(std::string&& message)
 {
+  if (!this->queue->push(std::move(message)))
+    {
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  if (this->writer_waiting.load())
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->condition.notify_one();
+    }
+}
+
+void Logger::run_writer()
+{
+  // Write at most that much data at once
+  constexpr std::size_t max_batch_size = 65536;
+  std::string batch;
+  std::string message;
+  std::size_t reported_dropped = 0;
+  while (true)
+    {
+      while (batch.size() < max_batch_size && this->queue->pop(message))
+        batch += message;
+      const auto dropped = this->dropped.load(std::memory_order_relaxed);
+      if (dropped != reported_dropped)
+        {
+          batch += "[WARNING]: " + std::to_string(dropped - reported_dropped) +
+              " log messages were dropped, because the writer thread could not keep up\n";
+          reported_dropped = dropped;
+        }
+      if (!batch.empty())
+        {
+          this->stream.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+          this->stream.flush();
+          batch.clear();
+          continue;
+        }
+      if (this->stopping.load())
+        return;
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->writer_waiting.store(true);
+      // A message may have been pushed before we set writer_waiting, its
+      // notification was then not sent
+      if (this->queue->empty() && !this->stopping.load())
+        this->condition.wait_for(lock, std::chrono::milliseconds(100));
+      this->writer_waiting.store(false);
+    }
 }
 
 std::unique_ptr<Logger>& Logger::instance()
@@ -53,13 +139,100 @@ std::unique_ptr<Logger>& Logger::instance()
         instance = std::make_unique<Logger>(log_level);
       else
         instance = std::make_unique<Logger>(log_level, log_file);
+      instance->load_filters();
+      if (Config::get_bool("log_async", false))
+        instance->start_async_writer(static_cast<std::size_t>(Config::get_int("log_async_queue_size", 65536)));
     }
   return instance;
 }
 
-std::ostream& Logger::get_stream(const int lvl)
+std::ostream& Logger::get_stream()
+{
+  return this->stream;
+}
+
+void Logger::update_min_level()
+{
+  this->min_level = *std::min_element(this->levels.begin(), this->levels.end());
+  for (const auto& pair: this->hostname_levels)
+    this->min_level = std::min(this->min_level, pair.second);
+  for (const auto& pair: this->jid_levels)
+    this->min_level = std::min(this->min_level, pair.second);
+}
+
+void Logger::set_subsystem_level(const logging_details::Subsystem subsystem, const int level)
+{
+  this->levels[subsystem] = level;
+  this->update_min_level();
+}
+
+void Logger::set_hostname_level(const std::string& hostname, const int level)
+{
+  this->hostname_levels[utils::tolower(hostname)] = level;
+  this->update_min_level();
+}
+
+void Logger::set_jid_level(const std::string& bare_jid, const int level)
+{
+  this->jid_levels[utils::tolower(bare_jid)] = level;
+  this->update_min_level();
+}
+
+/**
+ * Parse a list of “name:level” (or just “name”, for the debug level),
+ * separated by spaces
+ */
+static std::vector<std::pair<std::string, int>> parse_filters(const std::string& value)
+{
+  std::vector<std::pair<std::string, int>> res;
+  for (const auto& filter: utils::split(value, ' ', false))
+    {
+      const auto pos = filter.rfind(':');
+      if (pos == std::string::npos)
+        res.emplace_back(filter, debug_lvl);
+      else
+        res.emplace_back(filter.substr(0, pos), std::atoi(filter.data() + pos + 1));
+    }
+  return res;
+}
+
+void Logger::load_filters()
+{
+  for (std::size_t i = 0; i < logging_details::subsystem_names.size(); ++i)
+    {
+      const auto option = "log_level_"s + logging_details::subsystem_names[i];
+      const auto level = Config::get_int(option, -1);
+      if (level >= 0)
+        this->set_subsystem_level(static_cast<logging_details::Subsystem>(i), level);
+    }
+  for (const auto& filter: parse_filters(Config::get("log_filter_hostnames", "")))
+    this->set_hostname_level(filter.first, filter.second);
+  for (const auto& filter: parse_filters(Config::get("log_filter_jids", "")))
+    this->set_jid_level(filter.first, filter.second);
+}
+
+LogContext::LogContext(const std::string& jid, const std::string& hostname):
+  previous_level(Logger::instance()->context_level)
+{
+  auto& logger = *Logger::instance();
+  int level = -1;
+  if (!hostname.empty() && !logger.hostname_levels.empty())
+    {
+      const auto it = logger.hostname_levels.find(utils::tolower(hostname));
+      if (it != logger.hostname_levels.end())
+        level = it->second;
+    }
+  if (!jid.empty() && !logger.jid_levels.empty())
+    {
+      const auto it = logger.jid_levels.find(utils::tolower(jid.substr(0, jid.find('/'))));
+      if (it != logger.jid_levels.end() && (level < 0 || it->second < level))
+        level = it->second;
+    }
+  if (level >= 0 && (this->previous_level < 0 || level < this->previous_level))
+    logger.context_level = level;
+}
+
+LogContext::~LogContext()
 {
-  if (lvl >= this->log_level)
-    return this->stream;
-  return this->null_stream;
+  Logger::instance()->context_level = this->previous_level;
 }
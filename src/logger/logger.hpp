@@ -4,15 +4,36 @@
 /**
  * Singleton used in logger macros to write into files or stdout, with
  * various levels of severity.
- * Only the macros should be used.
+ * Only the macros should be used, and only from the main thread.
+ *
+ * The macros check the level before evaluating their arguments, so that
+ * the filtered out messages cost nothing.
+ *
+ * The level can be changed for each subsystem (the directory of the
+ * source file: network, irc, xmpp, etc), and for the messages logged while
+ * handling the data of a given IRC server or XMPP user (see LogContext).
+ *
+ * With the log_async option, the messages are formatted by the main
+ * thread, and written by a background thread: they are given to it
+ * through a lock-free queue, and written in batches.  If that queue is
+ * full, the message is dropped (and counted) instead of blocking.
  * @class Logger
  */
 
+#include <utils/spsc_queue.hpp>
+
+#include <condition_variable>
+#include <unordered_map>
 #include <memory>
+#include <array>
+#include <type_traits>
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <atomic>
+#include <thread>
+#include <mutex>
 
 #define debug_lvl 0
 #define info_lvl 1
@@ -42,29 +63,109 @@
 #endif
 
 
-/**
- * A buffer, used to construct an ostream that does nothing
- * when we output data in it
- */
-class NullBuffer: public std::streambuf
+namespace logging_details
 {
- public:
-  int overflow(int c) { return c; }
-};
+  enum Subsystem
+  {
+    network_subsystem,
+    irc_subsystem,
+    xmpp_subsystem,
+    database_subsystem,
+    bridge_subsystem,
+    other_subsystem,
+    subsystems_count
+  };
+  /**
+   * The names used in the log_level_<subsystem> options
+   */
+  extern const std::array<const char*, other_subsystem> subsystem_names;
+
+  constexpr bool starts_with(const char* str, const char* prefix)
+  {
+    for (; *prefix; ++str, ++prefix)
+      if (*str != *prefix)
+        return false;
+    return true;
+  }
+  /**
+   * The subsystem of the given source file, from its path. Evaluated at
+   * compile time.
+   */
+  constexpr Subsystem get_subsystem(const char* src_file)
+  {
+    return starts_with(src_file, "src/network/") ? network_subsystem:
+        starts_with(src_file, "src/irc/") ? irc_subsystem:
+        starts_with(src_file, "src/xmpp/") ? xmpp_subsystem:
+        starts_with(src_file, "src/database/") ? database_subsystem:
+        starts_with(src_file, "src/bridge/") ? bridge_subsystem:
+        other_subsystem;
+  }
+}
 
 class Logger
 {
+  friend class LogContext;
 public:
   static std::unique_ptr<Logger>& instance();
-  std::ostream& get_stream(const int);
+  std::ostream& get_stream();
   Logger(const int log_level, const std::string& log_file);
   Logger(const int log_level);
 
+  ~Logger();
+
   Logger(const Logger&) = delete;
   Logger& operator=(const Logger&) = delete;
   Logger(Logger&&) = delete;
   Logger& operator=(Logger&&) = delete;
 
+  /**
+   * Whether a message of that level, from that subsystem, must be
+   * logged. Called before each message is built, so it must stay cheap.
+   */
+  bool is_enabled(const int level, const logging_details::Subsystem subsystem=logging_details::other_subsystem) const
+  {
+    if (level < this->min_level)
+      return false;
+    if (this->context_level >= 0)
+      return level >= this->context_level;
+    return level >= this->levels[subsystem];
+  }
+  /**
+   * Set the level of a subsystem, instead of the global log_level.
+   */
+  void set_subsystem_level(const logging_details::Subsystem subsystem, const int level);
+  /**
+   * Set the level used for the messages logged while handling the data of
+   * this IRC server, or XMPP user (a bare JID).
+   */
+  void set_hostname_level(const std::string& hostname, const int level);
+  void set_jid_level(const std::string& bare_jid, const int level);
+  /**
+   * Read the log_level_<subsystem>, log_filter_hostnames and
+   * log_filter_jids options
+   */
+  void load_filters();
+  /**
+   * Start the thread writing the messages given to write_async()
+   */
+  void start_async_writer(const std::size_t queue_size);
+  bool is_async() const
+  {
+    return this->writer.joinable();
+  }
+  /**
+   * Give a formatted message to the writer thread. If its queue is full,
+   * the message is dropped.
+   */
+  void write_async(std::string&& message);
+  /**
+   * The number of messages dropped because the queue was full
+   */
+  std::size_t get_dropped() const
+  {
+    return this->dropped.load(std::memory_order_relaxed);
+  }
+
 #ifdef SYSTEMD_FOUND
   bool use_stdout() const
   {
@@ -76,11 +177,57 @@ public:
 
   const int log_level;
 private:
+  /**
+   * The body of the writer thread
+   */
+  void run_writer();
+  void update_min_level();
+
   std::ofstream ofstream{};
   std::ostream stream;
 
-  NullBuffer null_buffer;
-  std::ostream null_stream;
+  std::array<int, logging_details::subsystems_count> levels;
+  std::unordered_map<std::string, int> hostname_levels;
+  std::unordered_map<std::string, int> jid_levels;
+  /**
+   * The level of the current LogContext, if any (otherwise -1)
+   */
+  int context_level{-1};
+  /**
+   * The smallest level that can be logged, with any subsystem or context
+   */
+  int min_level;
+
+  std::unique_ptr<utils::SpscQueue<std::string>> queue;
+  std::thread writer;
+  std::atomic<bool> stopping{false};
+  std::atomic<std::size_t> dropped{0};
+  /**
+   * Only used to wake the writer thread up when it’s waiting for messages
+   */
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::atomic<bool> writer_waiting{false};
+};
+
+/**
+ * While this object exists, the level set for this XMPP user (the bare JID
+ * is taken from the given JID), or this IRC server, is used for all the
+ * messages. If several contexts (or both the user and the server) have a
+ * level, the lowest one is used.
+ */
+class LogContext
+{
+public:
+  explicit LogContext(const std::string& jid, const std::string& hostname="");
+  ~LogContext();
+  LogContext(const LogContext&) = delete;
+  LogContext& operator=(const LogContext&) = delete;
+  LogContext(LogContext&&) = delete;
+  LogContext& operator=(LogContext&&) = delete;
+
+private:
+  int previous_level;
 };
 
 namespace logging_details
@@ -98,6 +245,9 @@ namespace logging_details
     log(os, std::forward<U>(rest)...);
   }
 
+  /**
+   * Write the message, whose level has already been checked
+   */
   template <typename... U>
   void do_logging(const int level, int syslog_level, const char* src_file, int line, U&&... args)
   {
@@ -105,23 +255,29 @@ namespace logging_details
     if (Logger::instance()->use_systemd)
       {
         (void)level;
-        if (level >= Logger::instance()->log_level)
-          {
-            std::ostringstream os;
-            log(os, std::forward<U>(args)...);
-            sd_journal_send("MESSAGE=%s", os.str().data(),
-                            "PRIORITY=%i", syslog_level,
-                            "CODE_FILE=%s", src_file,
-                            "CODE_LINE=%i", line,
-                            nullptr);
-          }
+        std::ostringstream os;
+        log(os, std::forward<U>(args)...);
+        sd_journal_send("MESSAGE=%s", os.str().data(),
+                        "PRIORITY=%i", syslog_level,
+                        "CODE_FILE=%s", src_file,
+                        "CODE_LINE=%i", line,
+                        nullptr);
       }
     else
       {
   #endif
         (void)syslog_level;
         static const char* priority_names[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
-        auto& os = Logger::instance()->get_stream(level);
+        auto& logger = *Logger::instance();
+        if (logger.is_async())
+          {
+            std::ostringstream os;
+            os << '[' << priority_names[level] << "]: " << src_file << ':' << line << ":\t";
+            log(os, std::forward<U>(args)...);
+            logger.write_async(os.str());
+            return;
+          }
+        auto& os = logger.get_stream();
         os << '[' << priority_names[level] << "]: " << src_file << ':' << line << ":\t";
         log(os, std::forward<U>(args)...);
 #ifdef SYSTEMD_FOUND
@@ -130,10 +286,18 @@ namespace logging_details
   }
 }
 
-#define log_debug(...) logging_details::do_logging(debug_lvl, LOG_DEBUG, __FILENAME__, __LINE__, __VA_ARGS__)
+// The arguments are only evaluated if the level is enabled. The subsystem
+// is a compile-time constant.
+#define log_if_enabled(level, syslog_level, ...) \
+  do { if (Logger::instance()->is_enabled(level, std::integral_constant<logging_details::Subsystem, \
+                                          logging_details::get_subsystem(__FILENAME__)>::value)) \
+      logging_details::do_logging(level, syslog_level, __FILENAME__, __LINE__, __VA_ARGS__); \
+  } while (false)
+
+#define log_debug(...) log_if_enabled(debug_lvl, LOG_DEBUG, __VA_ARGS__)
 
-#define log_info(...) logging_details::do_logging(info_lvl, LOG_INFO, __FILENAME__, __LINE__, __VA_ARGS__)
+#define log_info(...) log_if_enabled(info_lvl, LOG_INFO, __VA_ARGS__)
 
-#define log_warning(...) logging_details::do_logging(warning_lvl, LOG_WARNING, __FILENAME__, __LINE__, __VA_ARGS__)
+#define log_warning(...) log_if_enabled(warning_lvl, LOG_WARNING, __VA_ARGS__)
 
-#define log_error(...) logging_details::do_logging(error_lvl, LOG_ERR, __FILENAME__, __LINE__, __VA_ARGS__)
+#define log_error(...) log_if_enabled(error_lvl, LOG_ERR, __VA_ARGS__)
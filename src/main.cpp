@@ -9,6 +9,9 @@
 #ifdef UDNS_FOUND
 # include <network/dns_handler.hpp>
 #endif
+#ifdef TIMERFD_FOUND
+# include <network/timer_socket_handler.hpp>
+#endif
 
 #include <atomic>
 #include <csignal>
@@ -107,10 +110,31 @@ static int main_loop(std::string hostname, std::string password)
   if (Config::get_int("identd_port", 113) != 0)
     identd = std::make_unique<IdentdServer>(*xmpp_component, p, static_cast<uint16_t>(Config::get_int("identd_port", 113)));
 
-  auto timeout = TimedEventsManager::instance().get_timeout();
+#ifdef TIMERFD_FOUND
+  std::unique_ptr<TimerSocketHandler> timer_handler;
+  if (Config::get_bool("use_timerfd", true))
+    {
+      timer_handler = std::make_unique<TimerSocketHandler>(p);
+      timer_handler->update();
+    }
+  const auto get_timeout = [&timer_handler]()
+  {
+    // The timerfd wakes us up when the events must be executed
+    if (timer_handler)
+      return utils::no_timeout;
+    return TimedEventsManager::instance().get_timeout();
+  };
+#else
+  const auto get_timeout = []() { return TimedEventsManager::instance().get_timeout(); };
+#endif
+
+  auto timeout = get_timeout();
   while (p->poll(timeout) != -1)
   {
-    TimedEventsManager::instance().execute_expired_events();
+#ifdef TIMERFD_FOUND
+    if (!timer_handler || timer_handler->consume_expiration())
+#endif
+      TimedEventsManager::instance().execute_expired_events();
     // Check for empty irc_clients (not connected, or with no joined
     // channel) and remove them
     xmpp_component->clean();
@@ -127,6 +151,9 @@ static int main_loop(std::string hostname, std::string password)
       xmpp_component->shutdown();
 #ifdef UDNS_FOUND
       dns_handler.destroy();
+#endif
+#ifdef TIMERFD_FOUND
+      timer_handler.reset();
 #endif
       if (identd)
         identd->shutdown();
@@ -162,7 +189,7 @@ static int main_loop(std::string hostname, std::string password)
                 xmpp_component->reset();
                 xmpp_component->start();
               };
-              TimedEvent event(std::chrono::steady_clock::now() + 2s, reconnect_later, reconnect_name);
+              TimedEvent event(std::chrono::steady_clock::now() + 2s, reconnect_later, reconnect_name, 500ms);
               TimedEventsManager::instance().add_event(std::move(event));
             }
         }
@@ -170,6 +197,9 @@ static int main_loop(std::string hostname, std::string password)
         {
 #ifdef UDNS_FOUND
           dns_handler.destroy();
+#endif
+#ifdef TIMERFD_FOUND
+          timer_handler.reset();
 #endif
           if (identd)
             identd->shutdown();
@@ -184,7 +214,13 @@ static int main_loop(std::string hostname, std::string password)
     if (exiting) // If we are exiting, do not wait for any timed event
       timeout = utils::no_timeout;
     else
-      timeout = TimedEventsManager::instance().get_timeout();
+      {
+#ifdef TIMERFD_FOUND
+        if (timer_handler)
+          timer_handler->update();
+#endif
+        timeout = get_timeout();
+      }
   }
   if (!xmpp_component->ever_auth)
     return 1; // To signal that the process did not properly start
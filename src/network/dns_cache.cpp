@@ -0,0 +1,93 @@
+#include <network/dns_cache.hpp>
+#include <network/resolver.hpp>
+#include <utils/tolower.hpp>
+
+#include <algorithm>
+
+constexpr std::chrono::seconds DnsCache::default_ttl;
+constexpr std::chrono::seconds DnsCache::negative_ttl;
+constexpr std::size_t DnsCache::max_size;
+
+DnsCache& DnsCache::instance()
+{
+  static DnsCache inst;
+  return inst;
+}
+
+const DnsCache::Entry* DnsCache::find(const std::string& hostname)
+{
+  auto it = this->entries.find(hostname);
+  if (it == this->entries.end())
+    return nullptr;
+  if (it->second.expiration <= std::chrono::steady_clock::now())
+    {
+      this->entries.erase(it);
+      return nullptr;
+    }
+  return &it->second;
+}
+
+void DnsCache::store(const std::string& hostname, Entry entry)
+{
+  if (this->entries.size() >= max_size && this->entries.find(hostname) == this->entries.end())
+    {
+      const auto now = std::chrono::steady_clock::now();
+      for (auto it = this->entries.begin(); it != this->entries.end();)
+        {
+          if (it->second.expiration <= now)
+            it = this->entries.erase(it);
+          else
+            ++it;
+        }
+      if (this->entries.size() >= max_size)
+        this->entries.erase(this->entries.begin());
+    }
+  this->entries[hostname] = std::move(entry);
+}
+
+void DnsCache::clear()
+{
+  this->entries.clear();
+}
+
+DnsCache::Entry DnsCache::resolve(const std::string& name)
+{
+  const auto hostname = utils::tolower(name);
+  if (const auto entry = this->find(hostname))
+    {
+      this->hits++;
+      return *entry;
+    }
+  this->misses++;
+
+  struct addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addr_res = nullptr;
+  const int res = ::getaddrinfo(hostname.data(), nullptr, &hints, &addr_res);
+
+  Entry entry;
+  std::chrono::seconds entry_ttl{0};
+  if (res == 0 && addr_res)
+    {
+      for (const struct addrinfo* rp = addr_res; rp; rp = rp->ai_next)
+        {
+          auto address = addr_to_string(rp);
+          if (!address.empty() &&
+              std::find(entry.addresses.begin(), entry.addresses.end(), address) == entry.addresses.end())
+            entry.addresses.push_back(std::move(address));
+        }
+      ::freeaddrinfo(addr_res);
+      entry_ttl = default_ttl;
+    }
+  else
+    {
+      entry.error = gai_strerror(res);
+      if (res == EAI_NONAME)
+        entry_ttl = negative_ttl;
+    }
+  entry.expiration = std::chrono::steady_clock::now() + entry_ttl;
+  if (entry_ttl.count() > 0)
+    this->store(hostname, entry);
+  return entry;
+}
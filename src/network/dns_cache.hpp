@@ -0,0 +1,76 @@
+#pragma once
+
+#include "biboumi.h"
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <map>
+
+/**
+ * The results of the getaddrinfo() hostname resolutions, shared by all the
+ * Resolvers, when biboumi is built without udns (with udns, each Resolver
+ * makes its own asynchronous queries, and this cache is not used).
+ *
+ * getaddrinfo() does not tell us any TTL, so the addresses are kept for
+ * default_ttl, and the failures (the name does not exist) for
+ * negative_ttl.  Temporary errors are never cached.
+ */
+class DnsCache
+{
+public:
+  struct Entry
+  {
+    /**
+     * The resolved IP addresses. Empty if the resolution failed.
+     */
+    std::vector<std::string> addresses;
+    std::string error;
+    std::chrono::steady_clock::time_point expiration;
+  };
+
+  static constexpr std::chrono::seconds default_ttl{60};
+  static constexpr std::chrono::seconds negative_ttl{30};
+  static constexpr std::size_t max_size{4096};
+
+  ~DnsCache() = default;
+  DnsCache(const DnsCache&) = delete;
+  DnsCache(DnsCache&&) = delete;
+  DnsCache& operator=(const DnsCache&) = delete;
+  DnsCache& operator=(DnsCache&&) = delete;
+
+  static DnsCache& instance();
+
+  /**
+   * Resolve the given hostname, unless the result is in the cache.
+   */
+  Entry resolve(const std::string& hostname);
+  /**
+   * Remove all the entries.
+   */
+  void clear();
+
+  std::size_t size() const
+  { return this->entries.size(); }
+  std::size_t get_hits() const
+  { return this->hits; }
+  std::size_t get_misses() const
+  { return this->misses; }
+
+  /**
+   * Add the entry of a (lowercase) hostname, or replace it.
+   */
+  void store(const std::string& hostname, Entry entry);
+
+private:
+  DnsCache() = default;
+  /**
+   * Return the entry for this hostname, if it has not expired.
+   */
+  const Entry* find(const std::string& hostname);
+
+  std::map<std::string, Entry> entries;
+
+  std::size_t hits{0};
+  std::size_t misses{0};
+};
@@ -0,0 +1,179 @@
+#include <network/io_uring.hpp>
+
+#if POLLER == IO_URING
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+using namespace std::string_literals;
+
+static int io_uring_setup(const unsigned entries, struct io_uring_params* params)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(const int fd, const unsigned to_submit, const unsigned min_complete,
+                          const unsigned flags, const void* arg, const std::size_t arg_size)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                                    flags, arg, arg_size));
+}
+
+IoUring::IoUring(const unsigned entries):
+  ring_fd(-1),
+  features(0),
+  sq_ring(MAP_FAILED),
+  sq_ring_size(0),
+  cq_ring(MAP_FAILED),
+  cq_ring_size(0),
+  sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+  sqes_size(0),
+  sqe_tail(0)
+{
+  struct io_uring_params params{};
+  // Many sockets may become ready at once, so we want a completion queue
+  // much bigger than the submission queue
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = entries * 8;
+  this->ring_fd = io_uring_setup(entries, &params);
+  if (this->ring_fd == -1 && errno == EINVAL)
+    { // Kernels older than 5.5 don’t know IORING_SETUP_CQSIZE
+      params = {};
+      this->ring_fd = io_uring_setup(entries, &params);
+    }
+  if (this->ring_fd == -1)
+    throw std::runtime_error("io_uring_setup failed: "s + strerror(errno));
+  // Without this feature (Linux 5.5), the completions that do not fit in
+  // the completion queue are lost, and we would wait forever for them
+  if (!(params.features & IORING_FEAT_NODROP))
+    {
+      ::close(this->ring_fd);
+      throw std::runtime_error("io_uring is too old");
+    }
+  this->features = params.features;
+
+  this->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  this->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    this->sq_ring_size = this->cq_ring_size = std::max(this->sq_ring_size, this->cq_ring_size);
+
+  this->sq_ring = ::mmap(nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQ_RING);
+  if (this->sq_ring == MAP_FAILED)
+    {
+      const auto error = "mmap of the io_uring submission queue failed: "s + strerror(errno);
+      ::close(this->ring_fd);
+      throw std::runtime_error(error);
+    }
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    this->cq_ring = this->sq_ring;
+  else
+    this->cq_ring = ::mmap(nullptr, this->cq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_CQ_RING);
+  this->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  if (this->cq_ring != MAP_FAILED)
+    this->sqes = static_cast<struct io_uring_sqe*>(::mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE,
+                                                          MAP_SHARED | MAP_POPULATE, this->ring_fd,
+                                                          IORING_OFF_SQES));
+  if (this->cq_ring == MAP_FAILED || this->sqes == MAP_FAILED)
+    {
+      const auto error = "mmap of the io_uring rings failed: "s + strerror(errno);
+      if (this->cq_ring != MAP_FAILED && this->cq_ring != this->sq_ring)
+        ::munmap(this->cq_ring, this->cq_ring_size);
+      ::munmap(this->sq_ring, this->sq_ring_size);
+      ::close(this->ring_fd);
+      throw std::runtime_error(error);
+    }
+
+  auto sq_ptr = static_cast<char*>(this->sq_ring);
+  this->sq_head = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.head);
+  this->sq_tail = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.tail);
+  this->sq_mask = *reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.ring_mask);
+  this->sq_entries = *reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.ring_entries);
+  this->sq_array = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.array);
+  this->sq_flags = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.flags);
+  this->sqe_tail = *this->sq_tail;
+
+  auto cq_ptr = static_cast<char*>(this->cq_ring);
+  this->cq_head = reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.head);
+  this->cq_tail = reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.tail);
+  this->cq_mask = *reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.ring_mask);
+  this->cqes = reinterpret_cast<struct io_uring_cqe*>(cq_ptr + params.cq_off.cqes);
+}
+
+IoUring::~IoUring()
+{
+  ::munmap(this->sqes, this->sqes_size);
+  if (this->cq_ring != this->sq_ring)
+    ::munmap(this->cq_ring, this->cq_ring_size);
+  ::munmap(this->sq_ring, this->sq_ring_size);
+  ::close(this->ring_fd);
+}
+
+struct io_uring_sqe* IoUring::get_sqe()
+{
+  if (this->sqe_tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE) >= this->sq_entries)
+    {
+      this->submit(0);
+      if (this->sqe_tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE) >= this->sq_entries)
+        return nullptr;
+    }
+  const unsigned index = this->sqe_tail & this->sq_mask;
+  this->sq_array[index] = index;
+  struct io_uring_sqe* sqe = &this->sqes[index];
+  ::memset(sqe, 0, sizeof(*sqe));
+  this->sqe_tail++;
+  return sqe;
+}
+
+int IoUring::submit(const unsigned wait_nr, const sigset_t* sigmask,
+                    const struct __kernel_timespec* timeout)
+{
+  // Publish the prepared entries before telling the kernel about them
+  __atomic_store_n(this->sq_tail, this->sqe_tail, __ATOMIC_RELEASE);
+  const unsigned to_submit = this->sqe_tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+  const unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  if (!timeout)
+    return io_uring_enter(this->ring_fd, to_submit, wait_nr, flags, sigmask, _NSIG / 8);
+  struct io_uring_getevents_arg arg{};
+  arg.sigmask = reinterpret_cast<uint64_t>(sigmask);
+  arg.sigmask_sz = _NSIG / 8;
+  arg.ts = reinterpret_cast<uint64_t>(timeout);
+  return io_uring_enter(this->ring_fd, to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG,
+                        &arg, sizeof(arg));
+}
+
+bool IoUring::supports_wait_timeout() const
+{
+  return this->features & IORING_FEAT_EXT_ARG;
+}
+
+std::size_t IoUring::reap(std::vector<struct io_uring_cqe>& cqes)
+{
+  std::size_t count = 0;
+  while (true)
+    {
+      unsigned head = *this->cq_head;
+      const unsigned tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+      count += tail - head;
+      for (; head != tail; ++head)
+        cqes.push_back(this->cqes[head & this->cq_mask]);
+      // Let the kernel reuse these entries
+      __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+      // The completion queue was full, the kernel kept the other
+      // completions aside: ask it to post them, now that there is room
+      if (!(__atomic_load_n(this->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+        return count;
+      if (io_uring_enter(this->ring_fd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, _NSIG / 8) == -1 &&
+          errno != EINTR)
+        return count;
+    }
+}
+
+#endif // POLLER == IO_URING
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <network/poller.hpp>
+
+#if POLLER == IO_URING
+
+#include <linux/io_uring.h>
+#include <signal.h>
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * A minimal wrapper around an io_uring instance, using the raw system
+ * calls: it maps the submission and completion rings, hands out
+ * submission queue entries, submits them (optionally waiting for
+ * completions in the same system call), and reaps the completions.
+ *
+ * Only what the Poller needs is implemented.
+ */
+class IoUring
+{
+public:
+  /**
+   * Create the io_uring instance. Throws a std::runtime_error if the
+   * kernel does not support it (or if it is disabled, or too old to keep
+   * the completions that do not fit in the completion queue), in which
+   * case the caller is expected to use something else.
+   */
+  explicit IoUring(const unsigned entries);
+  ~IoUring();
+  IoUring(const IoUring&) = delete;
+  IoUring(IoUring&&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+  IoUring& operator=(IoUring&&) = delete;
+
+  /**
+   * Return a zeroed submission queue entry, to be filled by the caller. It
+   * is submitted on the next call to submit(). If the submission queue is
+   * full, the pending entries are submitted first.  Returns nullptr if that
+   * fails.
+   */
+  struct io_uring_sqe* get_sqe();
+  /**
+   * Submit all the pending entries, and wait until at least wait_nr
+   * completions are available. The given signal mask is set only while
+   * waiting, like ppoll() or epoll_pwait() do.  If a timeout is given, we
+   * stop waiting when it expires: it must only be used if
+   * supports_wait_timeout() is true.
+   *
+   * Returns the value of io_uring_enter(): -1 on error, with errno set.
+   */
+  int submit(const unsigned wait_nr, const sigset_t* sigmask=nullptr,
+             const struct __kernel_timespec* timeout=nullptr);
+  /**
+   * Whether submit() can be given a timeout (Linux 5.11). Otherwise, a
+   * timeout request must be submitted to stop waiting.
+   */
+  bool supports_wait_timeout() const;
+  /**
+   * Move all the available completion entries at the end of the given
+   * vector, and return their number.  The completions that the kernel
+   * could not post because the completion queue was full are flushed
+   * and moved as well.
+   */
+  std::size_t reap(std::vector<struct io_uring_cqe>& cqes);
+
+private:
+  int ring_fd;
+  unsigned features;
+
+  void* sq_ring;
+  std::size_t sq_ring_size;
+  void* cq_ring;
+  std::size_t cq_ring_size;
+  struct io_uring_sqe* sqes;
+  std::size_t sqes_size;
+
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned* sq_array;
+  unsigned* sq_flags;
+  /**
+   * The tail of the entries we prepared, not yet published to the kernel
+   */
+  unsigned sqe_tail;
+
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+};
+
+#endif // POLLER == IO_URING
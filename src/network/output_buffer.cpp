@@ -0,0 +1,82 @@
+#include <network/output_buffer.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+OutputBuffer::OutputBuffer():
+  offset(0),
+  bytes(0)
+{}
+
+void OutputBuffer::push(std::string&& data)
+{
+  if (data.empty())
+    return;
+  this->push(std::make_shared<const std::string>(std::move(data)));
+}
+
+void OutputBuffer::push(Chunk chunk)
+{
+  if (!chunk || chunk->empty())
+    return;
+  this->bytes += chunk->size();
+  this->chunks.push_back(std::move(chunk));
+}
+
+std::size_t OutputBuffer::fill_iovecs(struct iovec* iovecs, const std::size_t max_iovecs) const
+{
+  const std::size_t count = std::min(max_iovecs, this->chunks.size());
+  auto it = this->chunks.begin();
+  for (std::size_t i = 0; i < count; ++i, ++it)
+    {
+      const std::size_t skip = (i == 0) ? this->offset: 0;
+      // unconsting the content is ok, sendmsg will never modify it
+      iovecs[i].iov_base = const_cast<char*>((*it)->data() + skip);
+      iovecs[i].iov_len = (*it)->size() - skip;
+    }
+  return count;
+}
+
+std::size_t OutputBuffer::fill_iovecs(struct iovec* iovecs, const std::size_t max_iovecs,
+                                      std::vector<Chunk>& chunks) const
+{
+  const std::size_t count = this->fill_iovecs(iovecs, max_iovecs);
+  chunks.insert(chunks.end(), this->chunks.begin(),
+                this->chunks.begin() + static_cast<std::ptrdiff_t>(count));
+  return count;
+}
+
+void OutputBuffer::consume(std::size_t size)
+{
+  assert(size <= this->bytes);
+  this->bytes -= size;
+  while (size > 0)
+    {
+      const std::size_t remaining = this->chunks.front()->size() - this->offset;
+      if (size < remaining)
+        {
+          this->offset += size;
+          return;
+        }
+      size -= remaining;
+      this->offset = 0;
+      this->chunks.pop_front();
+    }
+}
+
+void OutputBuffer::clear()
+{
+  this->chunks.clear();
+  this->offset = 0;
+  this->bytes = 0;
+}
+
+bool OutputBuffer::empty() const
+{
+  return this->chunks.empty();
+}
+
+std::size_t OutputBuffer::size() const
+{
+  return this->bytes;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * The data waiting to be written on a socket: a list of refcounted,
+ * immutable chunks, and how much of the first one was already written.
+ *
+ * Writing part of a chunk only moves that offset, nothing is ever
+ * copied. And the same chunk (for example a stanza serialized only once)
+ * can be queued on any number of sockets.
+ */
+class OutputBuffer
+{
+public:
+  using Chunk = std::shared_ptr<const std::string>;
+
+  OutputBuffer();
+  ~OutputBuffer() = default;
+  OutputBuffer(const OutputBuffer&) = delete;
+  OutputBuffer(OutputBuffer&&) = delete;
+  OutputBuffer& operator=(const OutputBuffer&) = delete;
+  OutputBuffer& operator=(OutputBuffer&&) = delete;
+
+  void push(std::string&& data);
+  void push(Chunk chunk);
+  /**
+   * Fill at most max_iovecs iovecs with the beginning of the pending data,
+   * and return the number of iovecs filled.
+   */
+  std::size_t fill_iovecs(struct iovec* iovecs, const std::size_t max_iovecs) const;
+  /**
+   * Same as above, and append the chunks used by these iovecs to the given
+   * vector, so that they are kept alive even if the buffer is cleared.
+   */
+  std::size_t fill_iovecs(struct iovec* iovecs, const std::size_t max_iovecs,
+                          std::vector<Chunk>& chunks) const;
+  /**
+   * Forget about the given number of bytes, at the beginning of the
+   * buffer, once they have been written.
+   */
+  void consume(std::size_t size);
+  void clear();
+  bool empty() const;
+  /**
+   * The number of bytes waiting to be written
+   */
+  std::size_t size() const;
+
+private:
+  std::deque<Chunk> chunks;
+  /**
+   * How many bytes of the first chunk have already been written
+   */
+  std::size_t offset;
+  std::size_t bytes;
+};
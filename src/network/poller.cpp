@@ -1,4 +1,5 @@
 #include <network/poller.hpp>
+#include <network/io_uring.hpp>
 #include <logger/logger.hpp>
 #include <utils/timed_events.hpp>
 
@@ -12,11 +13,84 @@
 #include <iostream>
 #include <stdexcept>
 
+#if POLLER == EPOLL || POLLER == IO_URING
+/**
+ * The initial and maximum number of events that a single call to
+ * epoll_pwait() can return.
+ */
+static constexpr std::size_t min_epoll_events = 16;
+static constexpr std::size_t max_epoll_events = 1024;
+# ifdef EPOLL_EDGE_TRIGGERED
+static constexpr uint32_t epoll_watched_events = EPOLLIN|EPOLLOUT|EPOLLET;
+# else
+static constexpr uint32_t epoll_watched_events = EPOLLIN;
+# endif
+#endif
+
+#if POLLER == IO_URING
+/**
+ * The number of entries of the submission queue. More requests can be
+ * queued during one iteration, they are then submitted in several calls.
+ */
+static constexpr unsigned uring_entries = 256;
+/**
+ * The number and size of the buffers provided to the kernel for the recv
+ * requests. A buffer is used only while the data it contains is handled,
+ * so we need at most one for each completion reaped at once.
+ */
+static constexpr uint16_t uring_buffers_count = 256;
+static constexpr unsigned uring_buffer_size = 16384;
+static constexpr uint16_t uring_buffer_group = 0;
+/**
+ * The maximum number of chunks given to a single sendmsg request
+ */
+static constexpr std::size_t uring_max_iovecs = 64;
+/**
+ * The kind of each request is in the lowest bits of its user_data. The
+ * requests that concern a socket have it in their upper half, which is
+ * never negative, and a generation number in between.
+ */
+static constexpr uint64_t uring_op_bits = 3;
+static constexpr uint64_t uring_op_mask = (1 << uring_op_bits) - 1;
+static constexpr uint64_t uring_generation_mask = 0xffffffff >> uring_op_bits;
+enum UringOp: uint64_t
+{
+  uring_poll_op = 1,
+  uring_recv_op,
+  uring_send_op,
+  uring_timeout_op,
+  uring_cancel_op,
+  uring_buffers_op,
+};
+#endif
+
 Poller::Poller()
 {
-#if POLLER == POLL
-  this->nfds = 0;
-#elif POLLER == EPOLL
+#if POLLER == IO_URING
+  this->epfd = -1;
+  this->uring_io = false;
+  this->uring_generation = 0;
+  try {
+    this->ring = std::make_unique<IoUring>(uring_entries);
+  } catch (const std::runtime_error& e) {
+    log_warning(e.what(), ", falling back to epoll");
+  }
+  if (this->ring)
+    {
+      // Check that the kernel can receive data in provided buffers (Linux
+      // 5.7), by providing them
+      this->uring_buffers.reset(new char[uring_buffers_count * uring_buffer_size]);
+      this->uring_provide_buffers(0, uring_buffers_count);
+      if (this->ring->submit(1) != -1 && this->ring->reap(this->uring_cqes) == 1)
+        this->uring_io = this->uring_cqes.front().res >= 0;
+      this->uring_cqes.clear();
+      if (!this->uring_io)
+        log_warning("io_uring cannot receive data in provided buffers, only polling with it");
+      return;
+    }
+#endif
+#if POLLER == EPOLL || POLLER == IO_URING
+  this->revents.resize(min_epoll_events);
   this->epfd = ::epoll_create1(0);
   if (this->epfd == -1)
     {
@@ -28,7 +102,11 @@ Poller::Poller()
 
 Poller::~Poller()
 {
-#if POLLER == EPOLL
+#if POLLER == IO_URING
+  // Cancel all the requests, before freeing the memory they use
+  this->ring.reset();
+#endif
+#if POLLER == EPOLL || POLLER == IO_URING
   if (this->epfd > 0)
     ::close(this->epfd);
 #endif
@@ -43,20 +121,34 @@ void Poller::add_socket_handler(SocketHandler* socket_handler)
 
   this->socket_handlers.emplace(socket_handler->get_socket(), socket_handler);
 
-  // We always watch all sockets for receive events
+  // We always watch all sockets for receive events (and for send events
+  // too, in edge-triggered mode)
 #if POLLER == POLL
-  this->fds[this->nfds].fd = socket_handler->get_socket();
-  this->fds[this->nfds].events = POLLIN;
-  this->nfds++;
+  struct pollfd pfd{};
+  pfd.fd = socket_handler->get_socket();
+  pfd.events = POLLIN;
+  this->fds_index.emplace(pfd.fd, this->fds.size());
+  this->fds.push_back(pfd);
 #endif
-#if POLLER == EPOLL
-  struct epoll_event event = {EPOLLIN, {socket_handler}};
+#if POLLER == IO_URING
+  if (this->ring)
+    {
+      auto& watch = this->uring_watches[socket_handler->get_socket()];
+      watch = {};
+      watch.events = POLLIN;
+      this->uring_arm(socket_handler->get_socket(), watch);
+      return;
+    }
+#endif
+#if POLLER == EPOLL || POLLER == IO_URING
+  struct epoll_event event = {epoll_watched_events, {socket_handler}};
   const int res = ::epoll_ctl(this->epfd, EPOLL_CTL_ADD, socket_handler->get_socket(), &event);
   if (res == -1)
     {
       log_error("epoll_ctl failed: ", strerror(errno));
       throw std::runtime_error("Could not add socket to epoll");
     }
+  this->epoll_events.emplace(socket_handler->get_socket(), epoll_watched_events);
 #endif
 }
 
@@ -66,23 +158,34 @@ void Poller::remove_socket_handler(const socket_t socket)
   if (it == this->socket_handlers.end())
     throw std::runtime_error("Trying to remove a SocketHandler that is not managed");
   this->socket_handlers.erase(it);
+  this->pending_sends.erase(socket);
 
 #if POLLER == POLL
-  for (size_t i = 0; i < this->nfds; i++)
+  const auto index_it = this->fds_index.find(socket);
+  const auto index = index_it->second;
+  this->fds_index.erase(index_it);
+  // Move the last pollfd into the slot of the one we remove
+  if (index != this->fds.size() - 1)
     {
-      if (this->fds[i].fd == socket)
-        {
-          // Move all subsequent pollfd by one on the left, erasing the
-          // value of the one we remove
-          for (size_t j = i; j < this->nfds - 1; ++j)
-            {
-              this->fds[j].fd = this->fds[j+1].fd;
-              this->fds[j].events= this->fds[j+1].events;
-            }
-          this->nfds--;
-        }
+      this->fds[index] = this->fds.back();
+      this->fds_index[this->fds[index].fd] = index;
     }
-#elif POLLER == EPOLL
+  this->fds.pop_back();
+#elif POLLER == EPOLL || POLLER == IO_URING
+# if POLLER == IO_URING
+  if (this->ring)
+    {
+      const auto watch_it = this->uring_watches.find(socket);
+      for (const auto user_data: {watch_it->second.poll_user_data, watch_it->second.recv_user_data,
+                                  watch_it->second.send_user_data})
+        if (user_data)
+          this->uring_cancel(user_data);
+      this->uring_watches.erase(watch_it);
+      this->uring_held_sockets.erase(socket);
+      return;
+    }
+# endif
+  this->epoll_events.erase(socket);
   const int res = ::epoll_ctl(this->epfd, EPOLL_CTL_DEL, socket, nullptr);
   if (res == -1)
     {
@@ -94,47 +197,70 @@ void Poller::remove_socket_handler(const socket_t socket)
 
 void Poller::watch_send_events(SocketHandler* socket_handler)
 {
-#if POLLER == POLL
-  for (size_t i = 0; i < this->nfds; ++i)
-    {
-      if (this->fds[i].fd == socket_handler->get_socket())
-        {
-          this->fds[i].events = POLLIN|POLLOUT;
-          return;
-        }
-    }
-  throw std::runtime_error("Cannot watch a non-registered socket for send events");
-#elif POLLER == EPOLL
-  struct epoll_event event = {EPOLLIN|EPOLLOUT, {socket_handler}};
-  const int res = ::epoll_ctl(this->epfd, EPOLL_CTL_MOD, socket_handler->get_socket(), &event);
-  if (res == -1)
-    {
-      log_error("epoll_ctl failed: ", strerror(errno));
-      throw std::runtime_error("Could not modify socket flags in epoll");
-    }
+  this->pending_sends.insert(socket_handler->get_socket());
+}
+
+void Poller::wait_for_send_events(SocketHandler* socket_handler)
+{
+#ifndef EPOLL_EDGE_TRIGGERED
+  this->update_events(socket_handler, false, true);
+#else
+  (void)socket_handler;
 #endif
 }
 
 void Poller::stop_watching_send_events(SocketHandler* socket_handler)
 {
+  this->pending_sends.erase(socket_handler->get_socket());
+#ifndef EPOLL_EDGE_TRIGGERED
+  this->update_events(socket_handler, false, false);
+#endif
+}
+
+void Poller::watch_recv_events(SocketHandler* socket_handler)
+{
+  this->update_events(socket_handler, true, true);
+}
+
+void Poller::stop_watching_recv_events(SocketHandler* socket_handler)
+{
+  this->update_events(socket_handler, true, false);
+}
+
+void Poller::update_events(SocketHandler* socket_handler, const bool recv, const bool watch)
+{
+  const auto socket = socket_handler->get_socket();
 #if POLLER == POLL
-  for (size_t i = 0; i <= this->nfds; ++i)
-    {
-      if (this->fds[i].fd == socket_handler->get_socket())
-        {
-          this->fds[i].events = POLLIN;
-          return;
-        }
-    }
-  throw std::runtime_error("Cannot watch a non-registered socket for send events");
-#elif POLLER == EPOLL
-  struct epoll_event event = {EPOLLIN, {socket_handler}};
-  const int res = ::epoll_ctl(this->epfd, EPOLL_CTL_MOD, socket_handler->get_socket(), &event);
+  const auto it = this->fds_index.find(socket);
+  if (it == this->fds_index.end())
+    throw std::runtime_error("Cannot change the watched events of a non-registered socket");
+  const short flag = recv ? POLLIN: POLLOUT;
+  auto& events = this->fds[it->second].events;
+  if (watch)
+    events = static_cast<short>(events | flag);
+  else
+    events = static_cast<short>(events & ~flag);
+#elif POLLER == EPOLL || POLLER == IO_URING
+# if POLLER == IO_URING
+  if (this->ring)
+    return this->uring_update_events(socket, recv ? POLLIN: POLLOUT, watch);
+# endif
+  const auto it = this->epoll_events.find(socket);
+  if (it == this->epoll_events.end())
+    throw std::runtime_error("Cannot change the watched events of a non-registered socket");
+  const uint32_t flag = recv ? EPOLLIN: EPOLLOUT;
+  const uint32_t events = watch ? (it->second | flag): (it->second & ~flag);
+  // Avoid a useless system call
+  if (events == it->second)
+    return;
+  struct epoll_event event = {events, {socket_handler}};
+  const int res = ::epoll_ctl(this->epfd, EPOLL_CTL_MOD, socket, &event);
   if (res == -1)
     {
       log_error("epoll_ctl failed: ", strerror(errno));
       throw std::runtime_error("Could not modify socket flags in epoll");
     }
+  it->second = events;
 #endif
 }
 
@@ -142,11 +268,12 @@ int Poller::poll(const std::chrono::milliseconds& timeout)
 {
   if (this->socket_handlers.empty() && timeout == utils::no_timeout)
     return -1;
+  this->flush_pending_sends();
 #if POLLER == POLL
   // Convert our nice timeout into this ugly struct
   struct timespec timeout_ts;
   struct timespec* timeout_tsp;
-  if (timeout > 0s)
+  if (timeout >= 0s)
     {
       auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
       timeout_ts.tv_sec = seconds.count();
@@ -159,44 +286,48 @@ int Poller::poll(const std::chrono::milliseconds& timeout)
   // Unblock all signals, only during the ppoll call
   sigset_t empty_signal_set;
   sigemptyset(&empty_signal_set);
-  int nb_events = ::ppoll(this->fds, this->nfds, timeout_tsp,
+  int nb_events = ::ppoll(this->fds.data(), this->fds.size(), timeout_tsp,
                           &empty_signal_set);
   if (nb_events < 0)
     {
       if (errno == EINTR)
-        return true;
+        return 0;
       log_error("poll failed: ", strerror(errno));
       throw std::runtime_error("Poll failed");
     }
   // We cannot possibly have more ready events than the number of fds we are
   // watching
-  assert(static_cast<unsigned int>(nb_events) <= this->nfds);
-  for (size_t i = 0; i < this->nfds && nb_events != 0; ++i)
+  assert(static_cast<unsigned int>(nb_events) <= this->fds.size());
+  this->ready_fds.clear();
+  for (size_t i = 0; i < this->fds.size() && this->ready_fds.size() != static_cast<size_t>(nb_events); ++i)
     {
-      auto socket_handler = this->socket_handlers.at(this->fds[i].fd);
-      if (this->fds[i].revents == 0)
+      if (this->fds[i].revents != 0)
+        this->ready_fds.emplace_back(this->fds[i].fd, this->fds[i].revents);
+    }
+  for (const auto& ready: this->ready_fds)
+    {
+      // A previous callback may have removed this socket
+      const auto it = this->socket_handlers.find(ready.first);
+      if (it == this->socket_handlers.end())
         continue;
-      else if (this->fds[i].revents & POLLIN && socket_handler->is_connected())
-        {
-          socket_handler->on_recv();
-          nb_events--;
-        }
-      else if (this->fds[i].revents & POLLOUT && socket_handler->is_connected())
-        {
-            socket_handler->on_send();
-            nb_events--;
-        }
-      else if (this->fds[i].revents & POLLOUT ||
-               this->fds[i].revents & POLLIN)
-        {
-          socket_handler->connect();
-          nb_events--;
-        }
+      auto socket_handler = it->second;
+      const auto revents = ready.second;
+      // Errors and hang-ups are reported even if we stopped watching
+      // receive events. They are handled as receive events, because
+      // recv() is what reports them
+      if (revents & (POLLIN|POLLERR|POLLHUP) && socket_handler->is_connected())
+        socket_handler->on_recv();
+      else if (revents & POLLOUT && socket_handler->is_connected())
+        socket_handler->on_send();
+      else if (revents & (POLLOUT|POLLIN|POLLERR|POLLHUP))
+        socket_handler->connect();
     }
-  return 1;
-#elif POLLER == EPOLL
-  static const size_t max_events = 12;
-  struct epoll_event revents[max_events];
+  return nb_events;
+#elif POLLER == EPOLL || POLLER == IO_URING
+# if POLLER == IO_URING
+  if (this->ring)
+    return this->uring_poll(timeout);
+# endif
   // Unblock all signals, only during the epoll_pwait call
   sigset_t empty_signal_set{};
   sigemptyset(&empty_signal_set);
@@ -204,7 +335,8 @@ int Poller::poll(const std::chrono::milliseconds& timeout)
   int real_timeout = std::numeric_limits<int>::max();
   if (timeout.count() < real_timeout) // Just avoid any potential int overflow
     real_timeout = static_cast<int>(timeout.count());
-  const int nb_events = ::epoll_pwait(this->epfd, revents, max_events, real_timeout,
+  const int nb_events = ::epoll_pwait(this->epfd, this->revents.data(),
+                                      static_cast<int>(this->revents.size()), real_timeout,
                                       &empty_signal_set);
   if (nb_events == -1)
     {
@@ -215,14 +347,41 @@ int Poller::poll(const std::chrono::milliseconds& timeout)
     }
   for (int i = 0; i < nb_events; ++i)
     {
-      auto socket_handler = static_cast<SocketHandler*>(revents[i].data.ptr);
-      if (revents[i].events & EPOLLIN && socket_handler->is_connected())
+      auto socket_handler = static_cast<SocketHandler*>(this->revents[i].data.ptr);
+      const auto events = this->revents[i].events;
+# ifdef EPOLL_EDGE_TRIGGERED
+      // Each edge is reported only once, so a socket that is both readable
+      // and writable must be handled for both events now.  Errors and
+      // hang-ups are handled as receive events, because recv() is what
+      // reports them.
+      if (!socket_handler->is_connected())
+        {
+          if (!(events & EPOLLOUT))
+            continue;
+          socket_handler->connect();
+          if (!socket_handler->is_connected())
+            continue;
+        }
+      const auto socket = socket_handler->get_socket();
+      if (events & (EPOLLIN|EPOLLERR|EPOLLHUP))
+        socket_handler->on_recv();
+      // The receive callback may have closed the socket
+      if (events & EPOLLOUT && this->is_managing_socket(socket) && socket_handler->is_connected())
+        socket_handler->on_send();
+# else
+      // Errors and hang-ups are reported even if we stopped watching
+      // receive events. They are handled as receive events too
+      if (events & (EPOLLIN|EPOLLERR|EPOLLHUP) && socket_handler->is_connected())
         socket_handler->on_recv();
-      else if (revents[i].events & EPOLLOUT && socket_handler->is_connected())
+      else if (events & EPOLLOUT && socket_handler->is_connected())
         socket_handler->on_send();
-      else if (revents[i].events & EPOLLOUT)
+      else if (events & (EPOLLOUT|EPOLLERR|EPOLLHUP))
         socket_handler->connect();
+# endif
     }
+  if (static_cast<std::size_t>(nb_events) == this->revents.size() &&
+      this->revents.size() < max_epoll_events)
+    this->revents.resize(this->revents.size() * 2);
   return nb_events;
 #endif
 }
@@ -236,3 +395,332 @@ bool Poller::is_managing_socket(const socket_t socket) const
 {
   return (this->socket_handlers.find(socket) != this->socket_handlers.end());
 }
+
+#if POLLER == IO_URING
+bool Poller::is_using_io_uring() const
+{
+  return this->uring_io;
+}
+#endif
+
+void Poller::flush_pending_sends()
+{
+  // The callbacks may add or remove some pending sends (for example, a
+  // socket closed while sending may queue a message on another one), so we
+  // work on a copy, until nothing is left. Sockets that could not send
+  // everything keep it in their SocketHandler’s buffer, and wait for their
+  // next send event.
+  while (!this->pending_sends.empty())
+    {
+      const auto pending = std::move(this->pending_sends);
+      this->pending_sends.clear();
+      for (const socket_t socket: pending)
+        {
+          const auto it = this->socket_handlers.find(socket);
+          if (it == this->socket_handlers.end() || !it->second->is_connected())
+            continue;
+#if POLLER == IO_URING
+          if (this->ring && this->uring_send(socket, it->second))
+            continue;
+#endif
+          it->second->on_send();
+        }
+    }
+}
+
+#if POLLER == IO_URING
+uint64_t Poller::uring_user_data(const socket_t socket, const uint64_t op)
+{
+  const uint64_t generation = ++this->uring_generation & uring_generation_mask;
+  return (static_cast<uint64_t>(socket) << 32) | (generation << uring_op_bits) | op;
+}
+
+struct io_uring_sqe* Poller::uring_get_sqe()
+{
+  auto sqe = this->ring->get_sqe();
+  if (!sqe)
+    {
+      // The kernel may refuse new requests until we reap the completions
+      // it could not post. They are handled at the end of this iteration
+      this->ring->reap(this->uring_cqes);
+      sqe = this->ring->get_sqe();
+    }
+  if (!sqe)
+    throw std::runtime_error("Could not submit io_uring request");
+  return sqe;
+}
+
+bool Poller::uring_uses_io(const SocketHandler* socket_handler) const
+{
+  return this->uring_io && socket_handler->accepts_poller_io() && socket_handler->is_connected();
+}
+
+void Poller::uring_arm(const socket_t socket, UringWatch& watch)
+{
+  // Errors and hang-ups are reported by poll requests even with no events
+  // to watch, for example when we stopped watching receive events
+  auto poll_events = watch.events;
+  bool poll = true;
+  if (this->uring_uses_io(this->socket_handlers.at(socket)))
+    {
+      // The data is received with recv requests, which report errors and
+      // hang-ups too, and the sendmsg requests wait for the socket to be
+      // writable themselves
+      poll_events = 0;
+      poll = !(watch.events & POLLIN);
+      if (watch.events & POLLIN && !watch.recv_user_data)
+        {
+          auto sqe = this->uring_get_sqe();
+          watch.recv_user_data = this->uring_user_data(socket, uring_recv_op);
+          sqe->opcode = IORING_OP_RECV;
+          sqe->fd = socket;
+          sqe->len = uring_buffer_size;
+          sqe->flags = IOSQE_BUFFER_SELECT;
+          sqe->buf_group = uring_buffer_group;
+          sqe->user_data = watch.recv_user_data;
+        }
+    }
+  if (poll && !watch.poll_user_data)
+    {
+      auto sqe = this->uring_get_sqe();
+      watch.poll_user_data = this->uring_user_data(socket, uring_poll_op);
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = socket;
+      sqe->poll_events = static_cast<uint16_t>(poll_events);
+      sqe->user_data = watch.poll_user_data;
+    }
+}
+
+void Poller::uring_cancel(const uint64_t user_data)
+{
+  auto sqe = this->uring_get_sqe();
+  sqe->opcode = (user_data & uring_op_mask) == uring_poll_op ? IORING_OP_POLL_REMOVE: IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = user_data;
+  sqe->user_data = uring_cancel_op;
+}
+
+bool Poller::uring_send(const socket_t socket, SocketHandler* socket_handler)
+{
+  // The data is sent in order: the next request is submitted once the
+  // previous one is completed, even if we stopped using sendmsg requests
+  // in the meantime
+  if (this->uring_watches.at(socket).send_user_data)
+    return true;
+  if (!this->uring_uses_io(socket_handler))
+    return false;
+  UringSend send{};
+  send.iovecs.resize(uring_max_iovecs);
+  const auto count = socket_handler->prepare_send(send.iovecs.data(), send.iovecs.size(), send.chunks);
+  // If a TLS error occured, the socket has been closed
+  if (count == 0 || !this->is_managing_socket(socket))
+    return true;
+  send.iovecs.resize(count);
+  auto sqe = this->uring_get_sqe();
+  const auto user_data = this->uring_user_data(socket, uring_send_op);
+  auto& pending = this->uring_sends.emplace(user_data, std::move(send)).first->second;
+  pending.msg.msg_iov = pending.iovecs.data();
+  pending.msg.msg_iovlen = pending.iovecs.size();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = socket;
+  sqe->addr = reinterpret_cast<uint64_t>(&pending.msg);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+  this->uring_watches.at(socket).send_user_data = user_data;
+  return true;
+}
+
+void Poller::uring_provide_buffers(const uint16_t first, const uint16_t count)
+{
+  auto sqe = this->uring_get_sqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = count;
+  sqe->addr = reinterpret_cast<uint64_t>(this->uring_buffers.get() + std::size_t{first} * uring_buffer_size);
+  sqe->len = uring_buffer_size;
+  sqe->off = first;
+  sqe->buf_group = uring_buffer_group;
+  sqe->user_data = uring_buffers_op;
+}
+
+void Poller::uring_update_events(const socket_t socket, const uint32_t flag, const bool watch)
+{
+  const auto it = this->uring_watches.find(socket);
+  if (it == this->uring_watches.end())
+    throw std::runtime_error("Cannot change the watched events of a non-registered socket");
+  auto& watch_state = it->second;
+  const uint32_t events = watch ? (watch_state.events | flag): (watch_state.events & ~flag);
+  if (watch_state.events == events)
+    return;
+  watch_state.events = events;
+  // Replace the submitted poll request, if any. If we are called by one of
+  // the callbacks of this socket, it is simply re-armed a bit earlier than
+  // usual
+  if (watch_state.poll_user_data)
+    {
+      this->uring_cancel(watch_state.poll_user_data);
+      // The request may complete before being cancelled, its result must
+      // be ignored
+      watch_state.poll_user_data = 0;
+    }
+  // If a recv request completes before being cancelled, the data it
+  // received is handled normally, and a new one is submitted only once
+  // it is completed
+  if (!(events & POLLIN) && watch_state.recv_user_data)
+    this->uring_cancel(watch_state.recv_user_data);
+  this->uring_arm(socket, watch_state);
+}
+
+int Poller::uring_poll(const std::chrono::milliseconds& timeout)
+{
+  int nb_events = this->uring_handle_held_data();
+  unsigned wait_nr = 0;
+  const struct __kernel_timespec* wait_timeout = nullptr;
+  // Don’t wait if some data was already handled, or if some completions
+  // were already reaped while submitting requests
+  if (timeout != 0ms && nb_events == 0 && this->uring_cqes.empty())
+    {
+      wait_nr = 1;
+      if (timeout > 0ms)
+        {
+          const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+          this->uring_timeout.tv_sec = seconds.count();
+          this->uring_timeout.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - seconds).count();
+          if (this->ring->supports_wait_timeout())
+            wait_timeout = &this->uring_timeout;
+          else if (auto sqe = this->ring->get_sqe())
+            {
+              // This timeout request completes either when it expires, or
+              // as soon as any other request completes
+              sqe->opcode = IORING_OP_TIMEOUT;
+              sqe->fd = -1;
+              sqe->addr = reinterpret_cast<uint64_t>(&this->uring_timeout);
+              sqe->len = 1;
+              sqe->off = 1;
+              sqe->user_data = uring_timeout_op;
+            }
+          else
+            wait_nr = 0;        // Rather than waiting forever
+        }
+    }
+  // Unblock all signals, only during the io_uring_enter call
+  sigset_t empty_signal_set{};
+  sigemptyset(&empty_signal_set);
+  if (this->ring->submit(wait_nr, &empty_signal_set, wait_timeout) == -1 &&
+      errno != EINTR && errno != EBUSY && errno != ETIME)
+    {
+      log_error("io_uring_enter: ", strerror(errno));
+      throw std::runtime_error("io_uring_enter failed");
+    }
+  this->ring->reap(this->uring_cqes);
+
+  // The callbacks may reap more completions, while submitting requests
+  for (std::size_t i = 0; i < this->uring_cqes.size(); ++i)
+    nb_events += this->uring_handle_completion(this->uring_cqes[i]);
+  this->uring_cqes.clear();
+  return nb_events;
+}
+
+int Poller::uring_handle_held_data()
+{
+  int nb_events = 0;
+  const auto sockets = this->uring_held_sockets;
+  for (const socket_t socket: sockets)
+    {
+      // A previous callback may have removed this socket
+      auto watch_it = this->uring_watches.find(socket);
+      if (watch_it == this->uring_watches.end() || !(watch_it->second.events & POLLIN))
+        continue;
+      this->uring_held_sockets.erase(socket);
+      const auto data = std::move(watch_it->second.held_data);
+      watch_it->second.held_data.clear();
+      this->socket_handlers.at(socket)->on_recv_result(data.data(), static_cast<ssize_t>(data.size()));
+      nb_events++;
+    }
+  return nb_events;
+}
+
+int Poller::uring_handle_completion(const struct io_uring_cqe cqe)
+{
+  const auto op = cqe.user_data & uring_op_mask;
+  if (op == uring_send_op)
+    // Whatever happened, the kernel is done with this data
+    this->uring_sends.erase(cqe.user_data);
+  else if (op == uring_buffers_op && cqe.res < 0)
+    log_error("Could not provide buffers to io_uring: ", strerror(-cqe.res));
+  if (op != uring_poll_op && op != uring_recv_op && op != uring_send_op)
+    return 0;
+
+  // The buffer in which the data was received is given back to the kernel
+  // once it is handled, even if the socket was removed
+  int buffer = -1;
+  const char* data = nullptr;
+  if (cqe.flags & IORING_CQE_F_BUFFER)
+    {
+      buffer = static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      data = this->uring_buffers.get() + static_cast<std::size_t>(buffer) * uring_buffer_size;
+    }
+
+  int nb_events = 0;
+  const auto socket = static_cast<socket_t>(cqe.user_data >> 32);
+  auto watch_it = this->uring_watches.find(socket);
+  uint64_t* user_data = nullptr;
+  if (watch_it != this->uring_watches.end())
+    user_data = op == uring_poll_op ? &watch_it->second.poll_user_data:
+                op == uring_recv_op ? &watch_it->second.recv_user_data:
+                                      &watch_it->second.send_user_data;
+  if (user_data && *user_data == cqe.user_data)
+    {
+      *user_data = 0;
+      auto socket_handler = this->socket_handlers.at(socket);
+      if (cqe.res == -EAGAIN && op != uring_poll_op)
+        {
+          // Old kernels do not wait until non-blocking sockets are ready.
+          // The data that was not sent is sent with on_send()
+          log_warning("io_uring does not wait for the sockets to be ready, only polling with it");
+          this->uring_io = false;
+          if (op == uring_send_op)
+            this->pending_sends.insert(socket);
+        }
+      else if (cqe.res != -ECANCELED)
+        {
+          nb_events = 1;
+          if (op == uring_poll_op)
+            {
+              // Errors are reported like poll(2) does
+              const auto events = cqe.res < 0 ? POLLERR: static_cast<uint32_t>(cqe.res);
+              if (events & (POLLIN|POLLERR|POLLHUP) && socket_handler->is_connected())
+                socket_handler->on_recv();
+              else if (events & POLLOUT && socket_handler->is_connected())
+                socket_handler->on_send();
+              else
+                socket_handler->connect();
+            }
+          else if (op == uring_recv_op && cqe.res > 0 &&
+                   (!(watch_it->second.events & POLLIN) || !watch_it->second.held_data.empty()))
+            {
+              // We stopped watching receive events after this request was
+              // submitted, or some previous data is still held
+              nb_events = 0;
+              watch_it->second.held_data.append(data, static_cast<std::size_t>(cqe.res));
+              this->uring_held_sockets.insert(socket);
+            }
+          else if (op == uring_recv_op && cqe.res == -ENOBUFS)
+            // All the buffers are in use, it will read the data itself
+            socket_handler->on_recv();
+          else if (op == uring_recv_op)
+            socket_handler->on_recv_result(data, cqe.res);
+          else
+            socket_handler->on_send_result(cqe.res);
+        }
+      // The callbacks may have removed the socket, or even replaced it
+      // with a new one, already armed, using the same number
+      watch_it = this->uring_watches.find(socket);
+      if (watch_it != this->uring_watches.end())
+        this->uring_arm(socket, watch_it->second);
+    }
+  if (buffer != -1)
+    this->uring_provide_buffers(static_cast<uint16_t>(buffer), 1);
+  return nb_events;
+}
+#endif
@@ -4,12 +4,14 @@
 #include <network/socket_handler.hpp>
 
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include <chrono>
 
 #define POLL 1
 #define EPOLL 2
 #define KQUEUE 3
+#define IO_URING 4
 #include <biboumi.h>
 #ifndef POLLER
  #define POLLER POLL
@@ -17,9 +19,19 @@
 
 #if POLLER == POLL
  #include <poll.h>
- #define MAX_POLL_FD_NUMBER 4096
-#elif POLLER == EPOLL
+ #include <vector>
+#elif POLLER == EPOLL || POLLER == IO_URING
   #include <sys/epoll.h>
+  #include <vector>
+  #if POLLER == IO_URING
+    #include <linux/io_uring.h>
+    #include <network/output_buffer.hpp>
+    #include <sys/socket.h>
+    #include <poll.h>
+    #include <memory>
+    #include <string>
+    class IoUring;
+  #endif
 #else
   #error Invalid POLLER value
 #endif
@@ -29,6 +41,16 @@
  * poll/epoll/kqueue/select etc to wait for events on these SocketHandlers,
  * and call the callbacks when event occurs.
  *
+ * With IO_URING, the SocketHandlers that accept it (see
+ * SocketHandler::accepts_poller_io()) are read from and written to with
+ * recv and sendmsg requests submitted to an io_uring instance, once they
+ * are connected. The received data is written in buffers provided to the
+ * kernel in advance, so that idle sockets do not use any. The readiness
+ * of the other sockets is watched with one-shot poll requests. All the
+ * requests added, modified or removed during one iteration are submitted,
+ * and the completions are waited for, with a single io_uring_enter
+ * call. If the kernel does not support io_uring, epoll is used instead.
+ *
  * TODO: support these pollers:
  * - kqueue(2)
  */
@@ -52,22 +74,46 @@ public:
    */
   void remove_socket_handler(const socket_t socket);
   /**
-   * Signal the poller that he needs to watch for send events for the given
-   * SocketHandler.
+   * Signal the poller that the given SocketHandler has some data to send.
+   *
+   * Its on_send() is called at the beginning of the next poll(), before
+   * waiting: all the data queued during one iteration of the main loop is
+   * sent in one go, without waiting for a send event that would arrive
+   * immediately anyway if the socket is writable.  If on_send() could not
+   * send everything, it calls wait_for_send_events().
    */
   void watch_send_events(SocketHandler* socket_handler);
+  /**
+   * Ask the poller to call on_send() (or connect(), if the SocketHandler
+   * is not connected yet) when the socket becomes writable.  Used when the
+   * kernel buffer is full, or to detect the end of a non-blocking
+   * connect().
+   *
+   * In edge-triggered mode, sockets are always watched for send events, so
+   * this does nothing.
+   */
+  void wait_for_send_events(SocketHandler* socket_handler);
   /**
    * Signal the poller that he needs to stop watching for send events for
    * this SocketHandler.
    */
   void stop_watching_send_events(SocketHandler* socket_handler);
+  /**
+   * Receive events are watched by default. A SocketHandler can stop
+   * watching them, to stop reading from its socket for a while.  Errors
+   * and hang-ups may still be reported as receive events.
+   */
+  void watch_recv_events(SocketHandler* socket_handler);
+  void stop_watching_recv_events(SocketHandler* socket_handler);
   /**
    * Wait for all watched events, and call the SocketHandlers' callbacks
    * when one is ready.  Returns if nothing happened before the provided
-   * timeout.  If the timeout is 0, it waits forever.  If there is no
-   * watched event, returns -1 immediately, ignoring the timeout value.
-   * Otherwise, returns the number of event handled. If 0 is returned this
-   * means that we were interrupted by a signal, or the timeout occured.
+   * timeout.  If the timeout is 0, it only handles the events that are
+   * already ready, and if it is negative (utils::no_timeout), it waits
+   * forever.  If there is no watched event, returns -1 immediately,
+   * ignoring the timeout value.  Otherwise, returns the number of event
+   * handled. If 0 is returned this means that we were interrupted by a
+   * signal, or the timeout occured.
    */
   int poll(const std::chrono::milliseconds& timeout);
   /**
@@ -78,8 +124,27 @@ public:
    * Whether the given socket is managed by the poller
    */
    bool is_managing_socket(const socket_t socket) const;
+#if POLLER == IO_URING
+  /**
+   * Whether the data of the SocketHandlers that accept it is received and
+   * sent with io_uring requests, and not with on_recv() and on_send()
+   */
+  bool is_using_io_uring() const;
+#endif
 
 private:
+  /**
+   * Start or stop watching the receive (if recv is true) or send events of
+   * the given SocketHandler
+   */
+  void update_events(SocketHandler* socket_handler, const bool recv, const bool watch);
+  /**
+   * The sockets for which watch_send_events() has been called since the
+   * last poll().
+   */
+  std::unordered_set<socket_t> pending_sends;
+  void flush_pending_sends();
+
   /**
    * A "list" of all the SocketHandlers that we manage, indexed by socket,
    * because that's what is returned by select/poll/etc when an event
@@ -88,10 +153,119 @@ private:
   std::unordered_map<socket_t, SocketHandler*> socket_handlers;
 
 #if POLLER == POLL
-  struct pollfd fds[MAX_POLL_FD_NUMBER];
-  nfds_t nfds;
-#elif POLLER == EPOLL
+  /**
+   * The array passed to poll(). It is kept contiguous: when a socket is
+   * removed, the last entry is moved into its slot.
+   */
+  std::vector<struct pollfd> fds;
+  /**
+   * The index of each managed socket in the fds array, to find, modify or
+   * remove its entry without scanning the whole array.
+   */
+  std::unordered_map<socket_t, std::size_t> fds_index;
+  /**
+   * The sockets that were reported ready by the last poll() call, and
+   * their revents. The callbacks are called from this copy because they
+   * may add or remove sockets, and thus reorder the fds array.
+   */
+  std::vector<std::pair<socket_t, short>> ready_fds;
+#elif POLLER == EPOLL || POLLER == IO_URING
   int epfd;
+  /**
+   * The buffer in which epoll_pwait() writes the ready events. It grows
+   * each time a single call fills it completely.
+   */
+  std::vector<struct epoll_event> revents;
+  /**
+   * The events currently watched for each socket
+   */
+  std::unordered_map<socket_t, uint32_t> epoll_events;
+#if POLLER == IO_URING
+  /**
+   * The ring used instead of epoll, or nullptr if io_uring is not
+   * available.
+   */
+  std::unique_ptr<IoUring> ring;
+  /**
+   * Whether we receive and send the data ourself, with recv and sendmsg
+   * requests. If the kernel cannot do that, only poll requests are used.
+   */
+  bool uring_io;
+  /**
+   * The buffers provided to the kernel, in which it writes the data of
+   * the recv requests.  Each buffer is given back to the kernel once the
+   * data it contains is handled.
+   */
+  std::unique_ptr<char[]> uring_buffers;
+  struct UringWatch
+  {
+    /**
+     * The poll(2) events we are interested in
+     */
+    uint32_t events;
+    /**
+     * The user_data of the poll, recv and sendmsg requests currently
+     * submitted for this socket, or 0.  They are unique, so that the
+     * completion of a request that was cancelled, or that concerns a
+     * previous socket with the same number, is recognized and ignored.
+     * Requests are one-shot: they are submitted again after the callbacks
+     * are called.
+     */
+    uint64_t poll_user_data;
+    uint64_t recv_user_data;
+    uint64_t send_user_data;
+    /**
+     * The data received by a recv request that completed after we stopped
+     * watching receive events. It is handled once we watch them again.
+     */
+    std::string held_data;
+  };
+  std::unordered_map<socket_t, UringWatch> uring_watches;
+  /**
+   * The sockets that have some held_data
+   */
+  std::unordered_set<socket_t> uring_held_sockets;
+  /**
+   * The sendmsg requests that are not completed yet, by user_data. The
+   * chunks are kept alive until the kernel is done with them, even if the
+   * socket is closed in the meantime.
+   */
+  struct UringSend
+  {
+    struct msghdr msg;
+    std::vector<struct iovec> iovecs;
+    std::vector<OutputBuffer::Chunk> chunks;
+  };
+  std::unordered_map<uint64_t, UringSend> uring_sends;
+  uint32_t uring_generation;
+  std::vector<struct io_uring_cqe> uring_cqes;
+  struct __kernel_timespec uring_timeout;
+
+  uint64_t uring_user_data(const socket_t socket, const uint64_t op);
+  struct io_uring_sqe* uring_get_sqe();
+  void uring_arm(const socket_t socket, UringWatch& watch);
+  void uring_cancel(const uint64_t user_data);
+  /**
+   * Submit a sendmsg request with the data of this SocketHandler, unless
+   * one is already submitted. Returns false if on_send() must be used
+   * instead.
+   */
+  bool uring_send(const socket_t socket, SocketHandler* socket_handler);
+  void uring_provide_buffers(const uint16_t first, const uint16_t count);
+  bool uring_uses_io(const SocketHandler* socket_handler) const;
+  void uring_update_events(const socket_t socket, const uint32_t flag, const bool watch);
+  int uring_poll(const std::chrono::milliseconds& timeout);
+  /**
+   * Call the callbacks corresponding to the given completion, and return 1
+   * if some were called
+   */
+  int uring_handle_completion(const struct io_uring_cqe cqe);
+  /**
+   * Pass their held_data to the SocketHandlers that watch receive events
+   * again, and return their number
+   */
+  int uring_handle_held_data();
+#endif
 #endif
 };
 
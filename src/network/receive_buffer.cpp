@@ -0,0 +1,123 @@
+#include <network/receive_buffer.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+ReceiveBuffer::ReceiveBuffer():
+  start(0),
+  end(0)
+{}
+
+const char* ReceiveBuffer::data() const
+{
+  return this->storage.data() + this->start;
+}
+
+std::size_t ReceiveBuffer::size() const
+{
+  return this->end - this->start;
+}
+
+bool ReceiveBuffer::empty() const
+{
+  return this->start == this->end;
+}
+
+std::size_t ReceiveBuffer::find(const char c, const std::size_t pos) const
+{
+  if (pos >= this->size())
+    return std::string::npos;
+  const auto found = static_cast<const char*>(std::memchr(this->data() + pos, c, this->size() - pos));
+  if (!found)
+    return std::string::npos;
+  return static_cast<std::size_t>(found - this->data());
+}
+
+std::size_t ReceiveBuffer::find(const std::string& str, const std::size_t pos) const
+{
+  return this->find(str.data(), pos, str.size());
+}
+
+std::size_t ReceiveBuffer::find(const char* str, const std::size_t pos) const
+{
+  return this->find(str, pos, std::strlen(str));
+}
+
+std::size_t ReceiveBuffer::find(const char* str, const std::size_t pos, const std::size_t count) const
+{
+  if (pos > this->size())
+    return std::string::npos;
+  const char* begin = this->data();
+  const char* last = begin + this->size();
+  const auto found = std::search(begin + pos, last, str, str + count);
+  if (found == last && count != 0)
+    return std::string::npos;
+  return static_cast<std::size_t>(found - begin);
+}
+
+std::string ReceiveBuffer::substr(const std::size_t pos, const std::size_t len) const
+{
+  assert(pos <= this->size());
+  return std::string(this->data() + pos, std::min(len, this->size() - pos));
+}
+
+void ReceiveBuffer::append(const char* data, const std::size_t size)
+{
+  if (size == 0)
+    return;
+  std::memcpy(this->prepare(size), data, size);
+  this->commit(size);
+}
+
+void ReceiveBuffer::consume(const std::size_t size)
+{
+  assert(size <= this->size());
+  this->start += size;
+  // Free the whole storage for the next read, without moving anything
+  if (this->start == this->end)
+    this->reset();
+}
+
+void ReceiveBuffer::clear()
+{
+  this->reset();
+}
+
+void ReceiveBuffer::reset()
+{
+  this->start = this->end = 0;
+  if (this->storage.size() > max_idle_capacity)
+    std::vector<char>().swap(this->storage);
+}
+
+char* ReceiveBuffer::prepare(const std::size_t size)
+{
+  if (this->storage.size() - this->end < size)
+    {
+      const auto data_size = this->size();
+      // Move the data back at the beginning of the storage, if that’s
+      // enough to make room. Otherwise, grow the storage (which moves
+      // everything anyway)
+      if (this->start > 0)
+        {
+          std::memmove(this->storage.data(), this->data(), data_size);
+          this->start = 0;
+          this->end = data_size;
+        }
+      if (this->storage.size() - this->end < size)
+        this->storage.resize(std::max(this->storage.size() * 2, this->end + size));
+    }
+  return this->storage.data() + this->end;
+}
+
+std::size_t ReceiveBuffer::free_space() const
+{
+  return this->storage.size() - this->end;
+}
+
+void ReceiveBuffer::commit(const std::size_t size)
+{
+  assert(this->end + size <= this->storage.size());
+  this->end += size;
+}
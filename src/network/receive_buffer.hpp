@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * The data received on a socket, not yet consumed by the parser.
+ *
+ * Consuming data from the front only moves an offset: the remaining data
+ * is moved back to the start of the storage only when some free space is
+ * needed at the end, so extracting N lines from a big read costs O(N)
+ * instead of O(N²).
+ *
+ * Once everything is consumed, the storage is released if it grew above
+ * max_idle_capacity (after one big read, for example), so that idle
+ * connections only keep a small buffer.
+ */
+class ReceiveBuffer
+{
+public:
+  ReceiveBuffer();
+  ~ReceiveBuffer() = default;
+  ReceiveBuffer(const ReceiveBuffer&) = delete;
+  ReceiveBuffer(ReceiveBuffer&&) = delete;
+  ReceiveBuffer& operator=(const ReceiveBuffer&) = delete;
+  ReceiveBuffer& operator=(ReceiveBuffer&&) = delete;
+
+  const char* data() const;
+  std::size_t size() const;
+  bool empty() const;
+  /**
+   * Same as the std::string methods, on the data not yet consumed.
+   */
+  std::size_t find(const char c, const std::size_t pos=0) const;
+  std::size_t find(const std::string& str, const std::size_t pos=0) const;
+  std::size_t find(const char* str, const std::size_t pos=0) const;
+  std::size_t find(const char* str, const std::size_t pos, const std::size_t count) const;
+  std::string substr(const std::size_t pos, const std::size_t len=std::string::npos) const;
+
+  void append(const char* data, const std::size_t size);
+  /**
+   * Forget about the given number of bytes, at the beginning of the data.
+   */
+  void consume(const std::size_t size);
+  void clear();
+  /**
+   * Return a pointer to at least size bytes of free space, at the end of
+   * the data. The data can be written directly there (by readv for
+   * example), and then added by calling commit().
+   */
+  char* prepare(const std::size_t size);
+  /**
+   * The size of the free space returned by the last prepare() call, which
+   * may be bigger than what was asked.
+   */
+  std::size_t free_space() const;
+  void commit(const std::size_t size);
+
+  static constexpr std::size_t max_idle_capacity = 16384;
+
+private:
+  /**
+   * Called when everything has been consumed
+   */
+  void reset();
+  std::vector<char> storage;
+  std::size_t start;
+  std::size_t end;
+};
@@ -4,6 +4,7 @@
 #include <cstring>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/stat.h>
 #ifdef UDNS_FOUND
 # include <udns.h>
 #endif
@@ -147,31 +148,39 @@ void Resolver::start_timer()
 
 std::vector<std::string> Resolver::look_in_etc_hosts(const std::string &hostname)
 {
-  std::ifstream hosts("/etc/hosts");
-  std::string line;
-
-  std::vector<std::string> results;
-  while (std::getline(hosts, line))
+  // The file is only parsed again when it is modified
+  static std::multimap<std::string, std::string> hosts_by_name;
+  static struct timespec last_modification{};
+  struct stat st{};
+  if (::stat("/etc/hosts", &st) == 0 &&
+      (st.st_mtim.tv_sec != last_modification.tv_sec || st.st_mtim.tv_nsec != last_modification.tv_nsec))
     {
-      if (line.empty())
-        continue;
-
-      std::string ip;
-      std::istringstream line_stream(line);
-      line_stream >> ip;
-      if (ip.empty() || ip[0] == '#')
-        continue;
+      last_modification = st.st_mtim;
+      hosts_by_name.clear();
 
-      std::string host;
-      while (line_stream >> host && !host.empty() && host[0] != '#')
+      std::ifstream hosts("/etc/hosts");
+      std::string line;
+      while (std::getline(hosts, line))
         {
-          if (hostname == host)
-            {
-              results.push_back(ip);
-              break;
-            }
+          if (line.empty())
+            continue;
+
+          std::string ip;
+          std::istringstream line_stream(line);
+          line_stream >> ip;
+          if (ip.empty() || ip[0] == '#')
+            continue;
+
+          std::string host;
+          while (line_stream >> host && !host.empty() && host[0] != '#')
+            hosts_by_name.emplace(host, ip);
         }
     }
+
+  std::vector<std::string> results;
+  const auto range = hosts_by_name.equal_range(hostname);
+  for (auto it = range.first; it != range.second; ++it)
+    results.push_back(it->second);
   return results;
 }
 
@@ -253,14 +262,22 @@ void Resolver::start_resolving(const std::string& hostname, const std::string& p
 {
   // If the resolution fails, the addr will be unset
   this->addr.reset(nullptr);
+  this->error_msg.clear();
 
-  const auto res = this->call_getaddrinfo(hostname.data(), port.data(), 0);
+  if (this->call_getaddrinfo(hostname.data(), port.data(), AI_NUMERICHOST) != 0)
+    {
+      // Only the hostnames go through the cache
+      const auto entry = DnsCache::instance().resolve(hostname);
+      for (const auto& address: entry.addresses)
+        this->call_getaddrinfo(address.data(), port.data(), AI_NUMERICHOST);
+      if (!this->addr)
+        this->error_msg = entry.error;
+    }
 
   this->resolved = true;
 
-  if (res != 0)
+  if (!this->addr)
     {
-      this->error_msg = gai_strerror(res);
       if (this->error_cb)
         this->error_cb(this->error_msg.data());
     }
@@ -2,6 +2,8 @@
 
 #include "biboumi.h"
 
+#include <network/dns_cache.hpp>
+
 #include <functional>
 #include <vector>
 #include <memory>
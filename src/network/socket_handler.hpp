@@ -1,7 +1,13 @@
 #pragma once
 
 #include <biboumi.h>
+#include <network/output_buffer.hpp>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include <memory>
+#include <vector>
 
 class Poller;
 
@@ -24,6 +30,32 @@ public:
   virtual void on_send() {}
   virtual void connect() {}
   virtual bool is_connected() const = 0;
+  /**
+   * Whether the poller may receive and send the data itself, once the
+   * socket is connected, instead of calling on_recv() and on_send() when
+   * the socket is ready. Only the IO_URING poller does that: it then uses
+   * the three functions below.
+   */
+  virtual bool accepts_poller_io() const { return false; }
+  /**
+   * Called with the result of a receive done by the poller: the received
+   * data, 0 if the remote host closed the connection, or a negative errno
+   * value.
+   */
+  virtual void on_recv_result(const char*, const ssize_t) {}
+  /**
+   * Fill at most max_iovecs iovecs with the data to send, and return the
+   * number of iovecs filled. The poller keeps a reference on the given
+   * chunks until the data is sent.
+   */
+  virtual std::size_t prepare_send(struct iovec*, const std::size_t,
+                                   std::vector<OutputBuffer::Chunk>&) { return 0; }
+  /**
+   * Called with the result of a send done by the poller: the number of
+   * bytes sent (from the start of what prepare_send() returned), or a
+   * negative errno value.
+   */
+  virtual void on_send_result(const ssize_t) {}
 
   socket_t get_socket() const
   { return this->socket; }
@@ -5,15 +5,139 @@
 
 #include <logger/logger.hpp>
 
+#include <algorithm>
 #include <cstring>
+#include <cstdint>
+#include <map>
 #include <unistd.h>
 #include <fcntl.h>
 
 using namespace std::string_literals;
 
+/**
+ * How long we wait for a connection attempt to succeed before starting the
+ * next one in parallel (the “Connection Attempt Delay” of RFC 8305), and
+ * before giving up on it.
+ */
+static constexpr auto connection_attempt_delay = 250ms;
+static constexpr auto connection_attempt_timeout = 5s;
+
+namespace
+{
+  struct PreferredFamily
+  {
+    int family;
+    std::chrono::steady_clock::time_point expiration;
+  };
+}
+
+/**
+ * The address family of the last successful connection to each host. It
+ * is forgotten after preferred_family_lifetime, like RFC 8305 suggests,
+ * and at most max_preferred_families hosts are remembered.
+ */
+static std::map<std::string, PreferredFamily> preferred_families;
+static constexpr auto preferred_family_lifetime = 10min;
+static constexpr std::size_t max_preferred_families = 1024;
+
+static int get_preferred_family(const std::string& host)
+{
+  const auto it = preferred_families.find(host);
+  if (it == preferred_families.end())
+    return AF_UNSPEC;
+  if (it->second.expiration <= std::chrono::steady_clock::now())
+    {
+      preferred_families.erase(it);
+      return AF_UNSPEC;
+    }
+  return it->second.family;
+}
+
+static void set_preferred_family(const std::string& host, const int family)
+{
+  const auto now = std::chrono::steady_clock::now();
+  if (preferred_families.size() >= max_preferred_families &&
+      preferred_families.find(host) == preferred_families.end())
+    {
+      // Forget the expired hosts, or at least the one that expires first
+      for (auto it = preferred_families.begin(); it != preferred_families.end();)
+        {
+          if (it->second.expiration <= now)
+            it = preferred_families.erase(it);
+          else
+            ++it;
+        }
+      if (preferred_families.size() >= max_preferred_families)
+        preferred_families.erase(std::min_element(preferred_families.begin(), preferred_families.end(),
+                                                  [](const auto& a, const auto& b)
+                                                  {
+                                                    return a.second.expiration < b.second.expiration;
+                                                  }));
+    }
+  preferred_families[host] = {family, now + preferred_family_lifetime};
+}
+
+ConnectionAttempt::ConnectionAttempt(std::shared_ptr<Poller>& poller, const socket_t socket,
+                                     TCPClientSocketHandler& owner, const struct addrinfo* rp):
+  SocketHandler(poller, socket),
+  owner(owner),
+  addrlen(rp->ai_addrlen),
+  watched(false),
+  timeout_event(0)
+{
+  memcpy(&this->addr, rp->ai_addr, std::min<std::size_t>(rp->ai_addrlen, sizeof(this->addr)));
+}
+
+ConnectionAttempt::~ConnectionAttempt()
+{
+  this->stop();
+}
+
+void ConnectionAttempt::start(const std::chrono::milliseconds& timeout)
+{
+  this->poller->add_socket_handler(this);
+  this->poller->wait_for_send_events(this);
+  this->watched = true;
+  this->timeout_event = TimedEventsManager::instance().add_event(
+      TimedEvent(std::chrono::steady_clock::now() + timeout,
+                 [this]() { this->owner.on_attempt_failed(*this, "connection timed out"); }));
+}
+
+void ConnectionAttempt::stop()
+{
+  const auto socket = this->release_socket();
+  if (socket != -1)
+    ::close(socket);
+}
+
+socket_t ConnectionAttempt::release_socket()
+{
+  const auto socket = this->socket;
+  if (this->watched)
+    {
+      TimedEventsManager::instance().cancel(this->timeout_event);
+      this->poller->remove_socket_handler(socket);
+      this->watched = false;
+    }
+  this->socket = -1;
+  return socket;
+}
+
+void ConnectionAttempt::connect()
+{
+  // connect() again tells us the result of the first call. Note that the
+  // owner may destroy us in these callbacks, nothing must be done after
+  // them.
+  if (::connect(this->socket, this->get_addr(), this->addrlen) == 0 || errno == EISCONN)
+    this->owner.on_attempt_connected(*this);
+  else if (errno != EINPROGRESS && errno != EALREADY)
+    this->owner.on_attempt_failed(*this, std::strerror(errno));
+}
+
 TCPClientSocketHandler::TCPClientSocketHandler(std::shared_ptr<Poller>& poller):
    TCPSocketHandler(poller),
    hostname_resolution_failed(false),
+   next_address(0),
    connected(false),
    connecting(false)
 {}
@@ -21,14 +145,15 @@ TCPClientSocketHandler::TCPClientSocketHandler(std::shared_ptr<Poller>& poller):
 TCPClientSocketHandler::~TCPClientSocketHandler()
 {
   this->close();
+  TimedEventsManager::instance().cancel(this->get_event_name("connection_attempts_cleanup"));
 }
 
-void TCPClientSocketHandler::init_socket(const struct addrinfo* rp)
+socket_t TCPClientSocketHandler::init_socket(const struct addrinfo* rp)
 {
-  if (this->socket != -1)
-    ::close(this->socket);
-  if ((this->socket = ::socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) == -1)
+  socket_t socket;
+  if ((socket = ::socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) == -1)
     throw std::runtime_error("Could not create socket: "s + std::strerror(errno));
+  utils::ScopeGuard close_on_error([socket]() { ::close(socket); });
   // Bind the socket to a specific address, if specified
   if (!this->bind_addr.empty())
     {
@@ -48,7 +173,7 @@ void TCPClientSocketHandler::init_socket(const struct addrinfo* rp)
           utils::ScopeGuard sg([result](){ freeaddrinfo(result); });
           for (; result; result = result->ai_next)
             {
-              if ((::bind(this->socket,
+              if ((::bind(socket,
                          reinterpret_cast<const struct sockaddr*>(result->ai_addr),
                          result->ai_addrlen)) == 0)
                 break;
@@ -61,15 +186,17 @@ void TCPClientSocketHandler::init_socket(const struct addrinfo* rp)
         }
     }
   int optval = 1;
-  if (::setsockopt(this->socket, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval)) == -1)
+  if (::setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval)) == -1)
     log_warning("Failed to enable TCP keepalive on socket: ", strerror(errno));
   // Set the socket on non-blocking mode.  This is useful to receive a EAGAIN
   // error when connect() would block, to not block the whole process if a
   // remote is not responsive.
-  const int existing_flags = ::fcntl(this->socket, F_GETFL, 0);
+  const int existing_flags = ::fcntl(socket, F_GETFL, 0);
   if ((existing_flags == -1) ||
-      (::fcntl(this->socket, F_SETFL, existing_flags | O_NONBLOCK) == -1))
+      (::fcntl(socket, F_SETFL, existing_flags | O_NONBLOCK) == -1))
     throw std::runtime_error("Could not initialize socket: "s + std::strerror(errno));
+  close_on_error.disable();
+  return socket;
 }
 
 void TCPClientSocketHandler::connect(const std::string& address, const std::string& port, const bool tls)
@@ -78,145 +205,183 @@ void TCPClientSocketHandler::connect(const std::string& address, const std::stri
   this->port = port;
   this->use_tls = tls;
 
-  struct addrinfo* addr_res;
+  // Our attempts are already in progress
+  if (this->connecting)
+    return;
 
-  if (!this->connecting)
+  if (!this->resolver.is_resolved())
     {
-      // Get the addrinfo from getaddrinfo (or using udns), only if
-      // this is the first call of this function.
-      if (!this->resolver.is_resolved())
-        {
-          log_info("Trying to connect to ", address, ":", port);
-          // Start the asynchronous process of resolving the hostname. Once
-          // the addresses have been found and `resolved` has been set to true
-          // (but connecting will still be false), TCPClientSocketHandler::connect()
-          // needs to be called, again.
-          this->resolver.resolve(address, port,
-                                 [this](const struct addrinfo*)
-                                 {
-                                   log_debug("Resolution success, calling connect() again");
-                                   this->connect();
-                                 },
-                                 [this](const char*)
-                                 {
-                                   log_debug("Resolution failed, calling connect() again");
-                                   this->connect();
-                                 });
-          return;
-        }
-      else
-        {
-          // The DNS resolver resolved the hostname and the available addresses
-          // where saved in the addrinfo linked list. Now, just use
-          // this list to try to connect.
-          addr_res = this->resolver.get_result().get();
-          if (!addr_res)
-            {
-              this->hostname_resolution_failed = true;
-              const auto msg = this->resolver.get_error_message();
-              this->close();
-              this->on_connection_failed(msg);
-              return ;
-            }
-        }
+      log_info("Trying to connect to ", address, ":", port);
+      // Start the asynchronous process of resolving the hostname. Once
+      // the addresses have been found and `resolved` has been set to true
+      // (but connecting will still be false), TCPClientSocketHandler::connect()
+      // needs to be called, again.
+      this->resolver.resolve(address, port,
+                             [this](const struct addrinfo*)
+                             {
+                               log_debug("Resolution success, calling connect() again");
+                               this->connect();
+                             },
+                             [this](const char*)
+                             {
+                               log_debug("Resolution failed, calling connect() again");
+                               this->connect();
+                             });
+      return;
     }
-  else
-    { // This function is called again, use the saved addrinfo structure,
-      // instead of re-doing the whole getaddrinfo process.
-      addr_res = &this->addrinfo;
+
+  // The DNS resolver resolved the hostname and the available addresses
+  // where saved in the addrinfo linked list. Now, just use
+  // this list to try to connect.
+  const struct addrinfo* addr_res = this->resolver.get_result().get();
+  if (!addr_res)
+    {
+      this->hostname_resolution_failed = true;
+      const auto msg = this->resolver.get_error_message();
+      this->close();
+      this->on_connection_failed(msg);
+      return ;
     }
+  this->addresses = sort_addresses(addr_res, get_preferred_family(this->address));
+  this->next_address = 0;
+  this->connecting = true;
+  this->last_error.clear();
+  this->start_next_attempt();
+}
 
-  for (struct addrinfo* rp = addr_res; rp; rp = rp->ai_next)
+void TCPClientSocketHandler::start_next_attempt()
+{
+  TimedEventsManager::instance().cancel(this->get_event_name("connection_attempt_delay"));
+  while (this->next_address < this->addresses.size())
     {
-      if (!this->connecting)
-        {
-          try {
-            this->init_socket(rp);
-          }
-          catch (const std::runtime_error& error) {
-            log_error("Failed to init socket: ", error.what());
-            break;
-          }
-        }
+      const struct addrinfo* rp = this->addresses[this->next_address++];
+      socket_t socket;
+      try {
+        socket = this->init_socket(rp);
+      }
+      catch (const std::runtime_error& error) {
+        log_error("Failed to init socket: ", error.what());
+        this->last_error = error.what();
+        continue;
+      }
+      auto attempt = std::make_unique<ConnectionAttempt>(this->poller, socket, *this, rp);
 
       this->display_resolved_ip(rp);
 
-      if (::connect(this->socket, rp->ai_addr, rp->ai_addrlen) == 0
-          || errno == EISCONN)
+      if (::connect(socket, rp->ai_addr, rp->ai_addrlen) == 0)
         {
-          log_info("Connection success.");
-#ifdef BOTAN_FOUND
-          if (this->use_tls)
-            try {
-                this->start_tls(this->address, this->port);
-              } catch (const Botan::Exception& e)
-              {
-                this->on_connection_failed("TLS error: "s + e.what());
-                this->close();
-                return ;
-              }
-#endif
-          TimedEventsManager::instance().cancel("connection_timeout" +
-                                                std::to_string(this->socket));
-          this->poller->add_socket_handler(this);
-          this->connected = true;
-          this->connecting = false;
-          this->connection_date = std::chrono::system_clock::now();
-
-          // Get our local TCP port and store it
-          this->local_port = static_cast<uint16_t>(-1);
-          if (rp->ai_family == AF_INET6)
-            {
-              struct sockaddr_in6 a{};
-              socklen_t l = sizeof(a);
-              if (::getsockname(this->socket, (struct sockaddr*)&a, &l) != -1)
-                this->local_port = ntohs(a.sin6_port);
-            }
-          else if (rp->ai_family == AF_INET)
-            {
-              struct sockaddr_in a{};
-              socklen_t l = sizeof(a);
-              if (::getsockname(this->socket, (struct sockaddr*)&a, &l) != -1)
-                this->local_port = ntohs(a.sin_port);
-            }
-
-          log_debug("Local port: ", this->local_port, ", and remote port: ", this->port);
-
-          this->on_connected();
+          this->attempts.push_back(std::move(attempt));
+          this->on_attempt_connected(*this->attempts.back());
           return ;
         }
-      else if (errno == EINPROGRESS || errno == EALREADY)
-        {   // retry this process later, when the socket
-            // is ready to be written on.
-          this->connecting = true;
-          this->poller->add_socket_handler(this);
-          this->poller->watch_send_events(this);
-          // Save the addrinfo structure, to use it on the next call
-          this->ai_addrlen = rp->ai_addrlen;
-          memcpy(&this->ai_addr, rp->ai_addr, this->ai_addrlen);
-          memcpy(&this->addrinfo, rp, sizeof(struct addrinfo));
-          this->addrinfo.ai_addr = reinterpret_cast<struct sockaddr*>(&this->ai_addr);
-          this->addrinfo.ai_next = nullptr;
-          // If the connection has not succeeded or failed in 5s, we consider
-          // it to have failed
-          TimedEventsManager::instance().add_event(
-                                                   TimedEvent(std::chrono::steady_clock::now() + 5s,
-                                                              std::bind(&TCPClientSocketHandler::on_connection_timeout, this),
-                                                              "connection_timeout" + std::to_string(this->socket)));
+      else if (errno == EINPROGRESS)
+        {   // We will be notified when the socket is ready to be written
+            // on. If this takes too long, try the next address in parallel
+          attempt->start(connection_attempt_timeout);
+          this->attempts.push_back(std::move(attempt));
+          if (this->next_address < this->addresses.size())
+            TimedEventsManager::instance().add_event(
+                TimedEvent(std::chrono::steady_clock::now() + connection_attempt_delay,
+                           [this]() { this->start_next_attempt(); },
+                           this->get_event_name("connection_attempt_delay")));
           return ;
         }
-      log_info("Connection failed:", std::strerror(errno));
+      log_info("Connection failed: ", std::strerror(errno));
+      this->last_error = std::strerror(errno);
     }
+  // Nothing left to try, wait for the attempts in progress
+  if (!this->attempts.empty())
+    return ;
   log_error("All connection attempts failed.");
+  const auto error = this->last_error;
   this->close();
-  this->on_connection_failed(std::strerror(errno));
-  return ;
+  this->on_connection_failed(error);
 }
 
-void TCPClientSocketHandler::on_connection_timeout()
+void TCPClientSocketHandler::on_attempt_failed(ConnectionAttempt& attempt, const std::string& reason)
 {
-  this->close();
-  this->on_connection_failed("connection timed out");
+  log_info("Connection failed: ", reason);
+  this->last_error = reason;
+  const auto it = std::find_if(this->attempts.begin(), this->attempts.end(),
+                               [&attempt](const auto& a) { return a.get() == &attempt; });
+  if (it != this->attempts.end())
+    {
+      this->retire_attempt(std::move(*it));
+      this->attempts.erase(it);
+    }
+  // Do not wait for the connection attempt delay to try the next address
+  this->start_next_attempt();
+}
+
+void TCPClientSocketHandler::on_attempt_connected(ConnectionAttempt& attempt)
+{
+  const auto family = attempt.get_family();
+  this->socket = attempt.release_socket();
+  this->stop_attempts();
+  set_preferred_family(this->address, family);
+
+  log_info("Connection success.");
+#ifdef BOTAN_FOUND
+  if (this->use_tls)
+    try {
+        this->start_tls(this->address, this->port);
+      } catch (const Botan::Exception& e)
+      {
+        this->on_connection_failed("TLS error: "s + e.what());
+        this->close();
+        return ;
+      }
+#endif
+  this->add_to_poller();
+  this->connected = true;
+  this->connecting = false;
+  this->connection_date = std::chrono::system_clock::now();
+
+  // Get our local TCP port and store it
+  this->local_port = static_cast<uint16_t>(-1);
+  if (family == AF_INET6)
+    {
+      struct sockaddr_in6 a{};
+      socklen_t l = sizeof(a);
+      if (::getsockname(this->socket, (struct sockaddr*)&a, &l) != -1)
+        this->local_port = ntohs(a.sin6_port);
+    }
+  else if (family == AF_INET)
+    {
+      struct sockaddr_in a{};
+      socklen_t l = sizeof(a);
+      if (::getsockname(this->socket, (struct sockaddr*)&a, &l) != -1)
+        this->local_port = ntohs(a.sin_port);
+    }
+
+  log_debug("Local port: ", this->local_port, ", and remote port: ", this->port);
+
+  this->on_connected();
+}
+
+void TCPClientSocketHandler::stop_attempts()
+{
+  TimedEventsManager::instance().cancel(this->get_event_name("connection_attempt_delay"));
+  for (auto& attempt: this->attempts)
+    this->retire_attempt(std::move(attempt));
+  this->attempts.clear();
+}
+
+void TCPClientSocketHandler::retire_attempt(std::unique_ptr<ConnectionAttempt>&& attempt)
+{
+  attempt->stop();
+  this->stopped_attempts.push_back(std::move(attempt));
+  const auto cleanup_name = this->get_event_name("connection_attempts_cleanup");
+  if (!TimedEventsManager::instance().find_event(cleanup_name))
+    TimedEventsManager::instance().add_event(
+        TimedEvent(std::chrono::steady_clock::now(),
+                   [this]() { this->stopped_attempts.clear(); },
+                   cleanup_name));
+}
+
+std::string TCPClientSocketHandler::get_event_name(const std::string& name) const
+{
+  return name + std::to_string(reinterpret_cast<std::uintptr_t>(this));
 }
 
 void TCPClientSocketHandler::connect()
@@ -226,18 +391,21 @@ void TCPClientSocketHandler::connect()
 
 void TCPClientSocketHandler::close()
 {
-  TimedEventsManager::instance().cancel("connection_timeout" +
-                                        std::to_string(this->socket));
+  this->stop_attempts();
+  // Only the attempts were managed by the poller, while connecting
+  this->connecting = false;
 
   TCPSocketHandler::close();
 
   this->connected = false;
   this->connecting = false;
   this->port.clear();
+  this->addresses.clear();
+  this->next_address = 0;
   this->resolver.clear();
 }
 
-void TCPClientSocketHandler::display_resolved_ip(struct addrinfo* rp) const
+void TCPClientSocketHandler::display_resolved_ip(const struct addrinfo* rp) const
 {
   if (rp->ai_family == AF_INET)
     log_debug("Trying IPv4 address ", addr_to_string(rp));
@@ -267,3 +435,29 @@ bool TCPClientSocketHandler::match_port_pair(const uint16_t local, const uint16_
   const auto remote_port = static_cast<uint16_t>(std::stoi(this->port));
   return local == this->local_port && remote == remote_port;
 }
+
+std::vector<const struct addrinfo*> sort_addresses(const struct addrinfo* addr_res, int preferred_family)
+{
+  // Keep the order given by the resolver within each address family, but
+  // interleave the families, starting with the preferred one
+  if (preferred_family == AF_UNSPEC && addr_res)
+    preferred_family = addr_res->ai_family;
+  std::vector<const struct addrinfo*> first;
+  std::vector<const struct addrinfo*> second;
+  for (const struct addrinfo* rp = addr_res; rp; rp = rp->ai_next)
+    {
+      if (rp->ai_family == preferred_family)
+        first.push_back(rp);
+      else
+        second.push_back(rp);
+    }
+  std::vector<const struct addrinfo*> res;
+  for (std::size_t i = 0; i < first.size() || i < second.size(); ++i)
+    {
+      if (i < first.size())
+        res.push_back(first[i]);
+      if (i < second.size())
+        res.push_back(second[i]);
+    }
+  return res;
+}
@@ -1,9 +1,70 @@
 #pragma once
 
 #include <network/tcp_socket_handler.hpp>
+#include <utils/timed_events.hpp>
+
+class TCPClientSocketHandler;
+
+/**
+ * A non-blocking connect() to one of the addresses of the remote server,
+ * made on behalf of a TCPClientSocketHandler.  Several of them can be in
+ * progress at the same time: the first one to succeed gives its socket to
+ * the TCPClientSocketHandler, and the others are abandoned.
+ */
+class ConnectionAttempt: public SocketHandler
+{
+ public:
+  ConnectionAttempt(std::shared_ptr<Poller>& poller, const socket_t socket,
+                    TCPClientSocketHandler& owner, const struct addrinfo* rp);
+  ~ConnectionAttempt();
+  ConnectionAttempt(const ConnectionAttempt&) = delete;
+  ConnectionAttempt(ConnectionAttempt&&) = delete;
+  ConnectionAttempt& operator=(const ConnectionAttempt&) = delete;
+  ConnectionAttempt& operator=(ConnectionAttempt&&) = delete;
+
+  /**
+   * Wait for the connection to succeed or fail, for at most the given
+   * duration.
+   */
+  void start(const std::chrono::milliseconds& timeout);
+  /**
+   * Stop watching the socket, and close it unless it has been released.
+   */
+  void stop();
+  /**
+   * Stop watching the socket, and give its ownership to the caller.
+   */
+  socket_t release_socket();
+  /**
+   * Called by the poller when the socket becomes writable, which means the
+   * connection either succeeded or failed.
+   */
+  void connect() override final;
+  /**
+   * Always false, so that the poller calls connect().
+   */
+  bool is_connected() const override final
+  { return false; }
+
+  const struct sockaddr* get_addr() const
+  { return reinterpret_cast<const struct sockaddr*>(&this->addr); }
+  socklen_t get_addrlen() const
+  { return this->addrlen; }
+  int get_family() const
+  { return this->addr.ss_family; }
+
+ private:
+  TCPClientSocketHandler& owner;
+  struct sockaddr_storage addr{};
+  socklen_t addrlen;
+  bool watched;
+  TimedEventHandle timeout_event;
+};
 
 class TCPClientSocketHandler: public TCPSocketHandler
 {
+  friend class ConnectionAttempt;
+
  public:
   TCPClientSocketHandler(std::shared_ptr<Poller>& poller);
   ~TCPClientSocketHandler();
@@ -11,14 +72,15 @@ class TCPClientSocketHandler: public TCPSocketHandler
    * Connect to the remote server, and call on_connected() if this
    * succeeds. If tls is true, we set use_tls to true and will also call
    * start_tls() when the connection succeeds.
+   *
+   * If the hostname resolves to more than one address, we do not wait for
+   * each attempt to fail before trying the next address: a new attempt is
+   * started every connection_attempt_delay, alternating between IPv6 and
+   * IPv4, starting with the address family that worked the last time we
+   * connected to this host (RFC 8305). The first attempt to succeed wins.
    */
   void connect(const std::string& address, const std::string& port, const bool tls);
   void connect() override final;
-  /**
-   * Called by a TimedEvent, when the connection did not succeed or fail
-   * after a given time.
-   */
-  void on_connection_timeout();
   /**
    * Called when the connection is successful.
    */
@@ -46,25 +108,53 @@ class TCPClientSocketHandler: public TCPSocketHandler
   /**
    * Display the resolved IP, just for information purpose.
    */
-  void display_resolved_ip(struct addrinfo* rp) const;
+  void display_resolved_ip(const struct addrinfo* rp) const;
  private:
   /**
-   * Initialize the socket with the parameters contained in the given
-   * addrinfo structure.
+   * Create a socket with the parameters contained in the given addrinfo
+   * structure, and return it.
+   */
+  socket_t init_socket(const struct addrinfo* rp);
+  /**
+   * Start connecting to the next address, if any. Once all the attempts
+   * have failed, call on_connection_failed().
+   */
+  void start_next_attempt();
+  /**
+   * Called when one of our attempts succeeded, or failed.
    */
-  void init_socket(const struct addrinfo* rp);
+  void on_attempt_connected(ConnectionAttempt& attempt);
+  void on_attempt_failed(ConnectionAttempt& attempt, const std::string& reason);
+  /**
+   * Abandon all the connection attempts still in progress.
+   */
+  void stop_attempts();
+  /**
+   * Stop the given attempt. It is only destroyed later, because the poller
+   * may still have events to report to it, or we may be running one of its
+   * callbacks.
+   */
+  void retire_attempt(std::unique_ptr<ConnectionAttempt>&& attempt);
+  /**
+   * Return the given TimedEvent name, made unique for this object.
+   */
+  std::string get_event_name(const std::string& name) const;
   /**
    * DNS resolver
    */
   Resolver resolver;
   /**
-   * Keep the details of the addrinfo returned by the resolver that
-   * triggered a EINPROGRESS error when connect()ing to it, to reuse it
-   * directly when connect() is called again.
+   * The resolved addresses (owned by the resolver), in the order in which
+   * we try them, and the index of the next one to try.
+   */
+  std::vector<const struct addrinfo*> addresses;
+  std::size_t next_address;
+  std::vector<std::unique_ptr<ConnectionAttempt>> attempts;
+  std::vector<std::unique_ptr<ConnectionAttempt>> stopped_attempts;
+  /**
+   * The reason why the last attempt failed
    */
-  struct addrinfo addrinfo{};
-  struct sockaddr_in6 ai_addr{};
-  socklen_t ai_addrlen{};
+  std::string last_error;
 
   /**
    * Hostname we are connected/connecting to
@@ -80,3 +170,10 @@ class TCPClientSocketHandler: public TCPSocketHandler
   bool connected;
   bool connecting;
 };
+
+/**
+ * Return the given addresses in the order in which they should be tried:
+ * alternating between the address families, starting with the preferred
+ * one (or with the family of the first address, if it is AF_UNSPEC).
+ */
+std::vector<const struct addrinfo*> sort_addresses(const struct addrinfo* addr_res, int preferred_family);
@@ -12,6 +12,8 @@
 #include <netinet/ip.h>
 
 #include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 
 template <typename RemoteSocketType>
 class TcpSocketServer: public SocketHandler
@@ -40,18 +42,32 @@ class TcpSocketServer: public SocketHandler
     if ((::listen(this->socket, 10)) == -1)
       throw std::runtime_error("listen() failed");
 
+    if (!set_non_blocking(this->socket))
+      throw std::runtime_error(std::string{"Could not initialize socket: "} + std::strerror(errno));
+
     this->accept();
   }
   ~TcpSocketServer() = default;
 
   void on_recv() override
   {
-    // Accept a RemoteSocketType
-    int socket = ::accept(this->socket, nullptr, nullptr);
-
-    auto client = std::make_unique<RemoteSocketType>(poller, socket, *this);
-    this->poller->add_socket_handler(client.get());
-    this->sockets.push_back(std::move(client));
+    // Accept all the pending RemoteSocketTypes, until accept() tells us
+    // that there is none left
+    int socket;
+    while ((socket = ::accept(this->socket, nullptr, nullptr)) != -1)
+      {
+        if (!set_non_blocking(socket))
+          {
+            log_warning("Failed to set accepted socket non-blocking: ", std::strerror(errno));
+            ::close(socket);
+            continue;
+          }
+        auto client = std::make_unique<RemoteSocketType>(poller, socket, *this);
+        this->poller->add_socket_handler(client.get());
+        this->sockets.push_back(std::move(client));
+      }
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      log_warning("accept() failed: ", std::strerror(errno));
   }
 
  protected:
@@ -66,4 +82,10 @@ class TcpSocketServer: public SocketHandler
   {
     return true;
   }
+  static bool set_non_blocking(const int socket)
+  {
+    const int existing_flags = ::fcntl(socket, F_GETFL, 0);
+    return existing_flags != -1 &&
+        ::fcntl(socket, F_SETFL, existing_flags | O_NONBLOCK) != -1;
+  }
 };
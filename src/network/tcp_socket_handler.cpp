@@ -4,9 +4,12 @@
 #include <network/poller.hpp>
 
 #include <logger/logger.hpp>
+#include <config/config.hpp>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <stdexcept>
+#include <algorithm>
 #include <unistd.h>
 #include <cerrno>
 #include <cstring>
@@ -16,9 +19,13 @@
 # include <botan/hex.h>
 # include <botan/auto_rng.h>
 # include <botan/tls_exceptn.h>
-# include <config/config.hpp>
 # include <utils/dirname.hpp>
 
+# ifdef BOTAN_HAS_TLS_SESSION_MANAGER_SQLITE
+#  include <botan/tls_session_manager_sqlite.h>
+#  include <utils/xdg.hpp>
+# endif
+
 namespace
 {
     Botan::AutoSeeded_RNG& get_rng()
@@ -26,7 +33,7 @@ namespace
       static Botan::AutoSeeded_RNG rng{};
       return rng;
     }
-    Botan::TLS::Session_Manager_In_Memory& get_session_manager()
+    Botan::TLS::Session_Manager_In_Memory& get_in_memory_session_manager()
     {
       static Botan::TLS::Session_Manager_In_Memory session_manager{get_rng()};
 #if BOTAN_VERSION_CODE < BOTAN_VERSION_CODE_FOR(2,4,0)
@@ -35,20 +42,129 @@ namespace
 #endif
       return session_manager;
     }
+# ifdef BOTAN_HAS_TLS_SESSION_MANAGER_SQLITE
+    /**
+     * By default, the sessions are saved next to the sqlite3 database, or
+     * in the XDG data directory if we use PostgreSQL (or no database at
+     * all)
+     */
+    std::string get_default_session_cache_path()
+    {
+      const auto db_name = Config::get("db_name", "");
+      if (db_name.empty() || db_name.find("postgres://") == 0 || db_name.find("postgresql://") == 0)
+        return xdg_data_path("tls_sessions.sqlite");
+      auto directory = utils::dirname(db_name);
+      if (directory.back() != '/')
+        directory += '/';
+      return directory + "tls_sessions.sqlite";
+    }
+    std::unique_ptr<Botan::TLS::Session_Manager> open_sqlite_session_manager(const std::string& path)
+    {
+      const auto max_sessions = Config::get_int("tls_session_cache_size", 10000);
+      const auto lifetime = Config::get_int("tls_session_lifetime", 7200);
+      return std::make_unique<Botan::TLS::Session_Manager_SQLite>(Config::get("password", ""), get_rng(), path,
+                                                                   static_cast<std::size_t>(std::max(max_sessions, 0)),
+                                                                   std::chrono::seconds(std::max(lifetime, 0)));
+    }
+    std::unique_ptr<Botan::TLS::Session_Manager> make_sqlite_session_manager()
+    {
+      const auto path = Config::get("tls_session_cache", get_default_session_cache_path());
+      if (path.empty())
+        return nullptr;
+      try {
+        auto res = open_sqlite_session_manager(path);
+        log_info("Using TLS session cache: ", path);
+        return res;
+      } catch (const std::exception& e) {
+        // The sessions are encrypted with the component password: the file
+        // can not be opened anymore once the password is changed (or if it
+        // is corrupted). The saved sessions are only an optimisation, so we
+        // start again with an empty file, instead of never resuming anything.
+        log_warning("Failed to open the TLS session cache ", path, ": ", e.what(),
+                    ". Recreating it, the saved TLS sessions are lost.");
+      }
+      try {
+        if (::unlink(path.data()) == -1 && errno != ENOENT)
+          throw std::runtime_error(std::string("Failed to remove the file: ") + strerror(errno));
+        auto res = open_sqlite_session_manager(path);
+        log_info("Using TLS session cache: ", path);
+        return res;
+      } catch (const std::exception& e) {
+        log_warning("Failed to recreate the TLS session cache ", path, ": ", e.what(),
+                    ". TLS sessions will only be kept in memory.");
+        return nullptr;
+      }
+    }
+# endif
+    /**
+     * The sessions are saved on disk if possible, so that the connections
+     * can resume their TLS session after a restart, instead of doing a full
+     * handshake.
+     */
+    Botan::TLS::Session_Manager& get_session_manager()
+    {
+# ifdef BOTAN_HAS_TLS_SESSION_MANAGER_SQLITE
+      static const auto sqlite_session_manager = make_sqlite_session_manager();
+      if (sqlite_session_manager)
+        return *sqlite_session_manager;
+# endif
+      return get_in_memory_session_manager();
+    }
 }
 #endif
 
-#ifndef UIO_FASTIOV
-# define UIO_FASTIOV 8
+#include <climits>
+
+// The maximum number of chunks given to a single sendmsg() call
+#ifdef IOV_MAX
+static constexpr std::size_t max_iovecs = IOV_MAX;
+#else
+static constexpr std::size_t max_iovecs = 1024;
+#endif
+
+#ifdef EPOLL_EDGE_TRIGGERED
+// We are notified only once when a socket becomes readable or writable, so
+// we must read or write until the kernel has nothing more for us
+static constexpr bool drain_socket = true;
+#else
+static constexpr bool drain_socket = false;
 #endif
 
 using namespace std::string_literals;
 using namespace std::chrono_literals;
 
+#ifdef BOTAN_FOUND
+/**
+ * The maximum size of the plaintext of a TLS record. Once we have that
+ * much data to send, there is no point in waiting for more before
+ * encrypting it.
+ */
+static constexpr std::size_t max_tls_record_size = 16384;
+#endif
+
+/**
+ * The size of the free space that we want at the end of in_buf, before
+ * reading into it
+ */
+static constexpr std::size_t min_in_buf_free_space = 2048;
+
+static std::size_t get_read_size()
+{
+  const int read_size = Config::get_int("read_size", 16384);
+  if (read_size < 4096)
+    return 4096;
+  return static_cast<std::size_t>(read_size);
+}
+
 
 TCPSocketHandler::TCPSocketHandler(std::shared_ptr<Poller>& poller):
   SocketHandler(poller, -1),
-  use_tls(false)
+  recv_paused(false),
+  output_high_watermark(0),
+  output_low_watermark(0),
+  above_output_high_watermark(false),
+  use_tls(false),
+  read_size(get_read_size())
 #ifdef BOTAN_FOUND
   ,credential_manager()
 #endif
@@ -77,107 +193,193 @@ void TCPSocketHandler::on_recv()
 
 void TCPSocketHandler::plain_recv()
 {
-  static constexpr size_t buf_size = 4096;
-  char buf[buf_size];
-  void* recv_buf = this->get_receive_buffer(buf_size);
-
-  if (recv_buf == nullptr)
-    recv_buf = buf;
-
-  const ssize_t ssize = this->do_recv(recv_buf, buf_size);
-
-  if (ssize > 0)
+  ssize_t ssize;
+  std::size_t buf_size;
+  do
     {
-      auto size = static_cast<std::size_t>(ssize);
-      if (buf == recv_buf)
+      void* recv_buf = this->get_receive_buffer(this->read_size);
+      if (recv_buf)
         {
-          // data needs to be placed in the in_buf string, because no buffer
-          // was provided to receive that data directly. The in_buf buffer
-          // will be handled in parse_in_buffer()
-          this->in_buf += std::string(buf, size);
+          buf_size = this->read_size;
+          ssize = this->do_recv(recv_buf, buf_size);
+          if (ssize > 0)
+            this->parse_in_buffer(static_cast<std::size_t>(ssize));
         }
-      this->parse_in_buffer(size);
-    }
+      else
+        {
+          // No buffer was provided to receive that data directly, it needs
+          // to be placed in in_buf, which will be handled in
+          // parse_in_buffer(). We read directly into its free space, and
+          // whatever does not fit goes into a second buffer, appended
+          // afterwards: in_buf only grows if we actually receive more data
+          // than it can hold
+          static thread_local std::vector<char> extra_buf;
+          extra_buf.resize(this->read_size);
+          struct iovec iovecs[2];
+          iovecs[0].iov_base = this->in_buf.prepare(min_in_buf_free_space);
+          iovecs[0].iov_len = this->in_buf.free_space();
+          iovecs[1].iov_base = extra_buf.data();
+          iovecs[1].iov_len = extra_buf.size();
+          buf_size = iovecs[0].iov_len + iovecs[1].iov_len;
+          ssize = this->do_recv(iovecs, 2);
+          if (ssize > 0)
+            {
+              const auto size = static_cast<std::size_t>(ssize);
+              const auto in_place = std::min(size, iovecs[0].iov_len);
+              this->in_buf.commit(in_place);
+              this->in_buf.append(extra_buf.data(), size - in_place);
+              this->parse_in_buffer(size);
+            }
+        }
+      // A short read means that the kernel buffer is empty
+    } while (drain_socket && ssize > 0 && static_cast<std::size_t>(ssize) == buf_size &&
+             this->socket != -1 && !this->recv_paused);
 }
 
 ssize_t TCPSocketHandler::do_recv(void* recv_buf, const size_t buf_size)
 {
-  ssize_t size = ::recv(this->socket, recv_buf, buf_size, 0);
+  struct iovec iovec;
+  iovec.iov_base = recv_buf;
+  iovec.iov_len = buf_size;
+  return this->do_recv(&iovec, 1);
+}
+
+ssize_t TCPSocketHandler::do_recv(struct iovec* iovecs, const int iovecs_count)
+{
+  ssize_t size = ::readv(this->socket, iovecs, iovecs_count);
   if (0 == size)
+    this->on_recv_error(0);
+  else if (-1 == size && errno != EAGAIN && errno != EWOULDBLOCK)
+    this->on_recv_error(errno);
+  return size;
+}
+
+void TCPSocketHandler::on_recv_error(const int error)
+{
+  if (error == 0)
     {
       this->on_connection_close("");
       this->close();
+      return;
     }
-  else if (-1 == size)
-    {
-      if (this->is_connecting())
-        log_warning("Error connecting: ", strerror(errno));
-      else
-        log_warning("Error while reading from socket: ", strerror(errno));
-      // Remember if we were connecting, or already connected when this
-      // happened, because close() sets this->connecting to false
-      const auto were_connecting = this->is_connecting();
+  if (this->is_connecting())
+    log_warning("Error connecting: ", strerror(error));
+  else
+    log_warning("Error while reading from socket: ", strerror(error));
+  // Remember if we were connecting, or already connected when this
+  // happened, because close() sets this->connecting to false
+  const auto were_connecting = this->is_connecting();
+  this->close();
+  if (were_connecting)
+    this->on_connection_failed(strerror(error));
+  else
+    this->on_connection_close(strerror(error));
+}
+
+bool TCPSocketHandler::accepts_poller_io() const
+{
+  return true;
+}
+
+void TCPSocketHandler::on_recv_result(const char* data, const ssize_t res)
+{
+  if (res <= 0)
+    return this->on_recv_error(static_cast<int>(-res));
+  const auto size = static_cast<std::size_t>(res);
+#ifdef BOTAN_FOUND
+  if (this->use_tls)
+    this->tls_received_data(reinterpret_cast<const Botan::byte*>(data), size);
+  else
+#endif
+    this->handle_received_data(data, size);
+}
+
+void TCPSocketHandler::handle_received_data(const char* data, const std::size_t size)
+{
+  void* recv_buf = this->get_receive_buffer(size);
+  if (recv_buf)
+    ::memcpy(recv_buf, data, size);
+  else
+    this->in_buf.append(data, size);
+  this->parse_in_buffer(size);
+}
+
+std::size_t TCPSocketHandler::prepare_send(struct iovec* iovecs, const std::size_t max_iovecs,
+                                           std::vector<OutputBuffer::Chunk>& chunks)
+{
+#ifdef BOTAN_FOUND
+  if (this->use_tls)
+    try {
+      this->seal_tls_data();
+    } catch (const Botan::Exception& e) {
+      this->on_connection_close("TLS error: "s + e.what());
       this->close();
-      if (were_connecting)
-        this->on_connection_failed(strerror(errno));
-      else
-        this->on_connection_close(strerror(errno));
+      return 0;
     }
-  return size;
+#endif
+  return this->out_buf.fill_iovecs(iovecs, max_iovecs, chunks);
 }
 
-void TCPSocketHandler::on_send()
+void TCPSocketHandler::on_send_result(const ssize_t res)
 {
-  struct iovec msg_iov[UIO_FASTIOV] = {};
-  struct msghdr msg{};
-  msg.msg_iov = msg_iov;
-  msg.msg_iovlen = 0;
-  for (const std::string& s: this->out_buf)
-    {
-      // unconsting the content of s is ok, sendmsg will never modify it
-      msg_iov[msg.msg_iovlen].iov_base = const_cast<char*>(s.data());
-      msg_iov[msg.msg_iovlen].iov_len = s.size();
-      msg.msg_iovlen++;
-      if (msg.msg_iovlen == UIO_FASTIOV)
-        break;
-    }
-  ssize_t res = ::sendmsg(this->socket, &msg, MSG_NOSIGNAL);
   if (res < 0)
     {
-      log_error("sendmsg failed: ", strerror(errno));
-      this->on_connection_close(strerror(errno));
+      log_error("sendmsg failed: ", strerror(static_cast<int>(-res)));
+      this->on_connection_close(strerror(static_cast<int>(-res)));
       this->close();
+      return;
     }
-  else
+  this->out_buf.consume(static_cast<std::size_t>(res));
+  this->check_output_watermarks();
+  this->send_pending_data();
+}
+
+void TCPSocketHandler::on_send()
+{
+#ifdef BOTAN_FOUND
+  if (this->use_tls)
+    try {
+      this->seal_tls_data();
+    } catch (const Botan::Exception& e) {
+      this->on_connection_close("TLS error: "s + e.what());
+      this->close();
+      return ;
+    }
+#endif
+  while (!this->out_buf.empty())
     {
-      auto size = static_cast<std::size_t>(res);
-      // remove all the strings that were successfully sent.
-      auto it = this->out_buf.begin();
-      while (it != this->out_buf.end())
+      struct iovec msg_iov[max_iovecs];
+      struct msghdr msg{};
+      msg.msg_iov = msg_iov;
+      msg.msg_iovlen = this->out_buf.fill_iovecs(msg_iov, max_iovecs);
+      ssize_t res = ::sendmsg(this->socket, &msg, MSG_NOSIGNAL);
+      if (res < 0)
         {
-          if (size >= it->size())
-            {
-              size -= it->size();
-              ++it;
-            }
-          else
-            {
-              // If one string has partially been sent, we use substr to
-              // crop it
-              if (size > 0)
-                *it = it->substr(size, std::string::npos);
-              break;
-            }
+          // The kernel buffer is full, we will be notified when we can send
+          // the rest
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+          log_error("sendmsg failed: ", strerror(errno));
+          this->on_connection_close(strerror(errno));
+          this->close();
+          return;
         }
-      this->out_buf.erase(this->out_buf.begin(), it);
-      if (this->out_buf.empty())
-        this->poller->stop_watching_send_events(this);
+      // Drop what was successfully sent. A partially sent chunk is kept,
+      // and only the offset to its first unsent byte is remembered
+      this->out_buf.consume(static_cast<std::size_t>(res));
+      this->check_output_watermarks();
+      if (!drain_socket)
+        break;
     }
+  if (this->out_buf.empty())
+    this->poller->stop_watching_send_events(this);
+  else
+    this->poller->wait_for_send_events(this);
 }
 
 void TCPSocketHandler::close()
 {
-  if (this->is_connected() || this->is_connecting())
+  if (this->socket != -1 && this->poller->is_managing_socket(this->socket))
     this->poller->remove_socket_handler(this->get_socket());
   if (this->socket != -1)
     {
@@ -186,6 +388,7 @@ void TCPSocketHandler::close()
     }
   this->in_buf.clear();
   this->out_buf.clear();
+  this->check_output_watermarks();
 }
 
 void TCPSocketHandler::send_data(std::string&& data)
@@ -204,11 +407,36 @@ void TCPSocketHandler::send_data(std::string&& data)
     this->raw_send(std::move(data));
 }
 
+void TCPSocketHandler::send_data(OutputBuffer::Chunk data)
+{
+#ifdef BOTAN_FOUND
+  if (this->use_tls)
+    {
+      // Each connection encrypts it differently, it cannot be shared
+      if (data)
+        this->send_data(std::string(*data));
+      return;
+    }
+#endif
+  this->raw_send(std::move(data));
+}
+
 void TCPSocketHandler::raw_send(std::string&& data)
 {
   if (data.empty())
     return ;
-  this->out_buf.emplace_back(std::move(data));
+  this->out_buf.push(std::move(data));
+  this->check_output_watermarks();
+  if (this->is_connected())
+    this->poller->watch_send_events(this);
+}
+
+void TCPSocketHandler::raw_send(OutputBuffer::Chunk data)
+{
+  if (!data || data->empty())
+    return ;
+  this->out_buf.push(std::move(data));
+  this->check_output_watermarks();
   if (this->is_connected())
     this->poller->watch_send_events(this);
 }
@@ -224,6 +452,71 @@ bool TCPSocketHandler::is_using_tls() const
   return this->use_tls;
 }
 
+void TCPSocketHandler::pause_recv()
+{
+  if (this->recv_paused)
+    return;
+  this->recv_paused = true;
+  if (this->poller->is_managing_socket(this->socket))
+    this->poller->stop_watching_recv_events(this);
+}
+
+void TCPSocketHandler::resume_recv()
+{
+  if (!this->recv_paused)
+    return;
+  this->recv_paused = false;
+  if (this->poller->is_managing_socket(this->socket))
+    this->poller->watch_recv_events(this);
+}
+
+bool TCPSocketHandler::is_recv_paused() const
+{
+  return this->recv_paused;
+}
+
+void TCPSocketHandler::add_to_poller()
+{
+  this->poller->add_socket_handler(this);
+  if (this->recv_paused)
+    this->poller->stop_watching_recv_events(this);
+}
+
+void TCPSocketHandler::set_output_watermarks(const std::size_t high, const std::size_t low)
+{
+  this->output_high_watermark = high;
+  this->output_low_watermark = std::min(low, high);
+  this->check_output_watermarks();
+}
+
+std::size_t TCPSocketHandler::get_output_size() const
+{
+  return this->out_buf.size();
+}
+
+bool TCPSocketHandler::is_above_output_high_watermark() const
+{
+  return this->above_output_high_watermark;
+}
+
+void TCPSocketHandler::check_output_watermarks()
+{
+  const auto size = this->out_buf.size();
+  if (!this->above_output_high_watermark)
+    {
+      if (this->output_high_watermark > 0 && size > this->output_high_watermark)
+        {
+          this->above_output_high_watermark = true;
+          this->on_output_high_watermark();
+        }
+    }
+  else if (size <= this->output_low_watermark || this->output_high_watermark == 0)
+    {
+      this->above_output_high_watermark = false;
+      this->on_output_low_watermark();
+    }
+}
+
 void* TCPSocketHandler::get_receive_buffer(const size_t) const
 {
   return nullptr;
@@ -231,7 +524,7 @@ void* TCPSocketHandler::get_receive_buffer(const size_t) const
 
 void TCPSocketHandler::consume_in_buffer(const std::size_t size)
 {
-  this->in_buf = this->in_buf.substr(size, std::string::npos);
+  this->in_buf.consume(size);
 }
 
 #ifdef BOTAN_FOUND
@@ -242,66 +535,78 @@ void TCPSocketHandler::start_tls(const std::string& address, const std::string&
   auto policy_directory = Config::get("policy_directory", utils::dirname(Config::get_filename()));
   if (!policy_directory.empty() && policy_directory[policy_directory.size()-1] != '/')
     policy_directory += '/';
-  this->policy.load(policy_directory + "policy.txt");
-  this->policy.load(policy_directory + address + ".policy.txt");
+  this->policy = get_tls_policy(policy_directory, address);
   this->tls = std::make_unique<Botan::TLS::Client>(
       *this,
-      get_session_manager(), this->credential_manager, this->policy,
+      get_session_manager(), this->credential_manager, *this->policy,
       get_rng(), server_info, Botan::TLS::Protocol_Version::latest_tls_version());
 }
 
 void TCPSocketHandler::tls_recv()
 {
-  static constexpr size_t buf_size = 4096;
-  Botan::byte recv_buf[buf_size];
+  static thread_local std::vector<Botan::byte> recv_buffer;
+  recv_buffer.resize(this->read_size);
+  Botan::byte* recv_buf = recv_buffer.data();
+  const size_t buf_size = recv_buffer.size();
 
-  const ssize_t size = this->do_recv(recv_buf, buf_size);
-  if (size > 0)
+  ssize_t size;
+  do
     {
-      const bool was_active = this->tls->is_active();
-      try {
-        this->tls->received_data(recv_buf, static_cast<size_t>(size));
-      } catch (const Botan::Exception& e) {
-        // May happen if the server sends malformed TLS data (buggy server,
-        // or more probably we are just connected to a server that sends
-        // plain-text)
-        this->on_connection_close("TLS error: "s + e.what());
-        this->close();
-        return ;
-      }
-      if (!was_active && this->tls->is_active())
-        this->on_tls_activated();
-    }
+      size = this->do_recv(recv_buf, buf_size);
+      if (size > 0 && !this->tls_received_data(recv_buf, static_cast<size_t>(size)))
+        return;
+    } while (drain_socket && size > 0 && static_cast<size_t>(size) == buf_size &&
+             this->socket != -1 && !this->recv_paused);
+}
+
+bool TCPSocketHandler::tls_received_data(const Botan::byte* data, const std::size_t size)
+{
+  const bool was_active = this->tls->is_active();
+  try {
+    this->tls->received_data(data, size);
+  } catch (const Botan::Exception& e) {
+    // May happen if the server sends malformed TLS data (buggy server,
+    // or more probably we are just connected to a server that sends
+    // plain-text)
+    this->on_connection_close("TLS error: "s + e.what());
+    this->close();
+    return false;
+  }
+  if (!was_active && this->tls->is_active())
+    this->on_tls_activated();
+  return true;
 }
 
 void TCPSocketHandler::tls_send(std::string&& data)
 {
-  // We may not be connected yet, or the tls session has
-  // not yet been negotiated
+  this->pre_buf.insert(this->pre_buf.end(),
+                       std::make_move_iterator(data.begin()),
+                       std::make_move_iterator(data.end()));
+  // We may not be connected yet, or the tls session has not yet been
+  // negotiated: the data will be sent once it’s done
   if (this->tls && this->tls->is_active())
     {
-      const bool was_active = this->tls->is_active();
-      if (!this->pre_buf.empty())
-        {
-          this->tls->send(this->pre_buf.data(), this->pre_buf.size());
-          this->pre_buf.clear();
-        }
-      if (!data.empty())
-        this->tls->send(reinterpret_cast<const Botan::byte*>(data.data()),
-                       data.size());
-      if (!was_active && this->tls->is_active())
-        this->on_tls_activated();
+      // Otherwise, the data written during this iteration of the event
+      // loop is encrypted all at once (in as few TLS records as possible)
+      // in on_send(), unless we already have enough to fill a record
+      if (this->pre_buf.size() >= max_tls_record_size)
+        this->seal_tls_data();
+      else if (this->is_connected())
+        this->poller->watch_send_events(this);
     }
-  else
-    this->pre_buf.insert(this->pre_buf.end(),
-                         std::make_move_iterator(data.begin()),
-                         std::make_move_iterator(data.end()));
+}
+
+void TCPSocketHandler::seal_tls_data()
+{
+  if (!this->tls || !this->tls->is_active() || this->pre_buf.empty())
+    return;
+  this->tls->send(this->pre_buf.data(), this->pre_buf.size());
+  this->pre_buf.clear();
 }
 
 void TCPSocketHandler::tls_record_received(uint64_t, const Botan::byte *data, size_t size)
 {
-  this->in_buf += std::string(reinterpret_cast<const char*>(data),
-                              size);
+  this->in_buf.append(reinterpret_cast<const char*>(data), size);
   if (!this->in_buf.empty())
     this->parse_in_buffer(size);
 }
@@ -334,7 +639,7 @@ void TCPSocketHandler::tls_verify_cert_chain(const std::vector<Botan::X509_Certi
                                              Botan::Usage_Type usage, const std::string& hostname,
                                              const Botan::TLS::Policy& policy)
 {
-  if (!this->policy.verify_certificate)
+  if (!this->policy->verify_certificate)
     {
       log_debug("Not verifying certificate due to domain policy ");
       return;
@@ -358,7 +663,8 @@ void TCPSocketHandler::tls_verify_cert_chain(const std::vector<Botan::X509_Certi
 
 void TCPSocketHandler::on_tls_activated()
 {
-  this->send_data({});
+  // Send the data written during the handshake
+  this->send_data(std::string{});
 }
 
 #endif // BOTAN_FOUND
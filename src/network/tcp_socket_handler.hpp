@@ -6,6 +6,8 @@
 #include <network/resolver.hpp>
 
 #include <network/credentials_manager.hpp>
+#include <network/output_buffer.hpp>
+#include <network/receive_buffer.hpp>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -52,6 +54,15 @@ public:
    * Write as much data from out_buf as possible, in the socket.
    */
   void on_send() override final;
+  /**
+   * The same, when the poller does the reads and writes itself (see
+   * SocketHandler::accepts_poller_io())
+   */
+  bool accepts_poller_io() const override final;
+  void on_recv_result(const char* data, const ssize_t res) override final;
+  std::size_t prepare_send(struct iovec* iovecs, const std::size_t max_iovecs,
+                           std::vector<OutputBuffer::Chunk>& chunks) override final;
+  void on_send_result(const ssize_t res) override final;
   /**
    * Add the given data to out_buf and tell our poller that we want to be
    * notified when a send event is ready.
@@ -60,6 +71,11 @@ public:
    * it. For example if we want to encrypt it.
    */
   void send_data(std::string&& data);
+  /**
+   * Same as above, but the data may be shared with other sockets: it is
+   * queued without being copied, unless it needs to be encrypted.
+   */
+  void send_data(OutputBuffer::Chunk data);
   /**
    * Watch the socket for send events, if our out buffer is not empty.
    */
@@ -91,6 +107,26 @@ public:
   }
 #endif
   bool is_using_tls() const;
+  /**
+   * Stop reading from the socket, until resume_recv() is called. Whatever
+   * the remote host sends meanwhile is kept in the kernel buffers, and TCP
+   * flow control eventually slows it down.
+   */
+  void pause_recv();
+  void resume_recv();
+  bool is_recv_paused() const;
+  /**
+   * When the size of the data waiting to be sent goes above the high
+   * watermark, on_output_high_watermark() is called. Then, when it goes
+   * back below the low one, on_output_low_watermark() is called.  A high
+   * watermark of 0 (the default) disables this.
+   */
+  void set_output_watermarks(const std::size_t high, const std::size_t low);
+  /**
+   * The number of bytes waiting to be sent
+   */
+  std::size_t get_output_size() const;
+  bool is_above_output_high_watermark() const;
 
 private:
   /**
@@ -102,6 +138,20 @@ private:
    * used if it’s not positive.
    */
   ssize_t do_recv(void* recv_buf, const size_t buf_size);
+  /**
+   * Same as above, with a scattered buffer, using ::readv()
+   */
+  ssize_t do_recv(struct iovec* iovecs, const int iovecs_count);
+  /**
+   * Close the connection after a failed read. An error of 0 means that the
+   * remote host closed it.
+   */
+  void on_recv_error(const int error);
+  /**
+   * Pass the received data to parse_in_buffer(), through in_buf or the
+   * buffer returned by get_receive_buffer()
+   */
+  void handle_received_data(const char* data, const std::size_t size);
   /**
    * Reads data from the socket and calls parse_in_buffer with it.
    */
@@ -111,9 +161,27 @@ private:
    * as we can.
    */
   void raw_send(std::string&& data);
+  void raw_send(OutputBuffer::Chunk data);
 
  protected:
   virtual bool is_connecting() const = 0;
+  /**
+   * Add our socket to the poller, taking into account whether reading is
+   * paused or not.
+   */
+  void add_to_poller();
+  virtual void on_output_high_watermark() {}
+  virtual void on_output_low_watermark() {}
+ private:
+  /**
+   * Called whenever the size of out_buf changes
+   */
+  void check_output_watermarks();
+  bool recv_paused;
+  std::size_t output_high_watermark;
+  std::size_t output_low_watermark;
+  bool above_output_high_watermark;
+ protected:
 #ifdef BOTAN_FOUND
   /**
    * Create the TLS::Client object, with all the callbacks etc. This must be
@@ -127,12 +195,24 @@ private:
    * before passing it to parse_in_buffer.
    */
   void tls_recv();
+  /**
+   * Pass the received data to the tls object. Returns false if the
+   * connection was closed because of a TLS error.
+   */
+  bool tls_received_data(const Botan::byte* data, const std::size_t size);
   /**
    * Pass the data to the tls object in order to encrypt it. The tls object
    * will then call raw_send as a callback whenever data as been encrypted
-   * and can be sent on the socket.
+   * and can be sent on the socket.  The data is kept in pre_buf, and
+   * actually encrypted in seal_tls_data(), called by on_send().
    */
   void tls_send(std::string&& data);
+  /**
+   * Pass all the data written so far (in pre_buf) to the tls object, so
+   * that it is encrypted as one TLS record (or as few as possible, if
+   * there is too much).  Does nothing if the handshake is not done.
+   */
+  void seal_tls_data();
   /**
    * Called by the tls object that some data has been decrypt. We call
    * parse_in_buffer() to handle that unencrypted data.
@@ -170,7 +250,7 @@ private:
   /**
    * Where data is added, when we want to send something to the client.
    */
-  std::vector<std::string> out_buf;
+  OutputBuffer out_buf;
 protected:
   /**
    * Whether we are using TLS on this connection or not.
@@ -179,10 +259,13 @@ protected:
   /**
    * Where data read from the socket is added until we can extract a full
    * and meaningful “message” from it.
-   *
-   * TODO: something more efficient than a string.
    */
-  std::string in_buf;
+  ReceiveBuffer in_buf;
+  /**
+   * How many bytes we try to read from the socket at once, from the
+   * read_size configuration option.
+   */
+  const std::size_t read_size;
   /**
    * Remove the given “size” first bytes from our in_buf.
    */
@@ -205,7 +288,11 @@ protected:
 protected:
   BasicCredentialsManager credential_manager;
 private:
-  BiboumiTLSPolicy policy;
+  /**
+   * Shared with all the other connections to the same address, see
+   * get_tls_policy()
+   */
+  std::shared_ptr<const BiboumiTLSPolicy> policy;
   /**
    * We use a unique_ptr because we may not want to create the object at
    * all. The Botan::TLS::Client object generates a handshake message and
@@ -220,7 +307,8 @@ private:
   std::unique_ptr<Botan::TLS::Client> tls;
   /**
    * An additional buffer to keep data that the user wants to send, but
-   * cannot because the handshake is not done.
+   * cannot because the handshake is not done, or that has not been
+   * encrypted yet, see seal_tls_data().
    */
   std::vector<Botan::byte> pre_buf;
 #endif // BOTAN_FOUND
@@ -0,0 +1,86 @@
+#include <biboumi.h>
+#ifdef TIMERFD_FOUND
+
+#include <network/timer_socket_handler.hpp>
+#include <network/poller.hpp>
+#include <utils/timed_events.hpp>
+#include <logger/logger.hpp>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+using namespace std::string_literals;
+
+TimerSocketHandler::TimerSocketHandler(std::shared_ptr<Poller>& poller):
+  SocketHandler(poller, ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+  armed(std::chrono::steady_clock::time_point::max()),
+  expired(false)
+{
+  if (this->socket == -1)
+    throw std::runtime_error("Failed to create the timerfd: "s + strerror(errno));
+  poller->add_socket_handler(this);
+}
+
+TimerSocketHandler::~TimerSocketHandler()
+{
+  if (this->poller->is_managing_socket(this->socket))
+    this->poller->remove_socket_handler(this->socket);
+  ::close(this->socket);
+}
+
+void TimerSocketHandler::on_recv()
+{
+  std::uint64_t expirations;
+  if (::read(this->socket, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+    log_error("Failed to read the timerfd: ", strerror(errno));
+  // The timer does not need to be disarmed, it only expires once
+  this->armed = std::chrono::steady_clock::time_point::max();
+  this->expired = true;
+}
+
+bool TimerSocketHandler::consume_expiration()
+{
+  const bool res = this->expired;
+  this->expired = false;
+  return res;
+}
+
+bool TimerSocketHandler::is_connected() const
+{
+  return true;
+}
+
+void TimerSocketHandler::update()
+{
+  const auto deadline = TimedEventsManager::instance().get_next_deadline();
+  if (deadline != this->armed)
+    this->set(deadline);
+}
+
+void TimerSocketHandler::set(const std::chrono::steady_clock::time_point& time_point)
+{
+  // An it_value of zero disarms the timer
+  struct itimerspec value{};
+  if (time_point != std::chrono::steady_clock::time_point::max())
+    {
+      // steady_clock is CLOCK_MONOTONIC
+      const auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch());
+      const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+      value.it_value.tv_sec = seconds.count();
+      value.it_value.tv_nsec = (since_epoch - seconds).count();
+      if (value.it_value.tv_sec <= 0 && value.it_value.tv_nsec <= 0)
+        value.it_value.tv_nsec = 1;
+    }
+  if (::timerfd_settime(this->socket, TFD_TIMER_ABSTIME, &value, nullptr) == -1)
+    {
+      log_error("Failed to set the timerfd: ", strerror(errno));
+      throw std::runtime_error("timerfd_settime failed");
+    }
+  this->armed = time_point;
+}
+
+#endif // TIMERFD_FOUND
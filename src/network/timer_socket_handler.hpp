@@ -0,0 +1,57 @@
+#pragma once
+
+#include <biboumi.h>
+#ifdef TIMERFD_FOUND
+
+#include <network/socket_handler.hpp>
+
+#include <chrono>
+
+/**
+ * Watch a timerfd with the poller, to wake up when the TimedEvents must be
+ * executed, instead of giving a timeout to each poll() call. The timer is
+ * set to the next deadline of the TimedEventsManager, with a nanosecond
+ * precision, and the events only need to be executed when it expired: the
+ * wakeups caused by the other sockets do not need to look at them.
+ *
+ * The events are not executed from on_recv(), but by the main loop, once
+ * poll() returned: an event may destroy a SocketHandler for which the
+ * poller still has an event to report in the same batch.
+ */
+class TimerSocketHandler: public SocketHandler
+{
+public:
+  explicit TimerSocketHandler(std::shared_ptr<Poller>& poller);
+  ~TimerSocketHandler();
+  TimerSocketHandler(const TimerSocketHandler&) = delete;
+  TimerSocketHandler(TimerSocketHandler&&) = delete;
+  TimerSocketHandler& operator=(const TimerSocketHandler&) = delete;
+  TimerSocketHandler& operator=(TimerSocketHandler&&) = delete;
+
+  void on_recv() override final;
+  /**
+   * Always true, there is nothing to connect to
+   */
+  bool is_connected() const override final;
+  /**
+   * Set the timer to the next deadline of the TimedEventsManager, if it
+   * changed since the last call.
+   */
+  void update();
+  /**
+   * Whether the timer expired since the last call, in which case the
+   * expired TimedEvents must be executed.
+   */
+  bool consume_expiration();
+
+private:
+  void set(const std::chrono::steady_clock::time_point& time_point);
+  /**
+   * The time at which the timer currently expires, or time_point::max() if
+   * it is disarmed.
+   */
+  std::chrono::steady_clock::time_point armed;
+  bool expired;
+};
+
+#endif // TIMERFD_FOUND
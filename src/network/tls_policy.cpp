@@ -3,6 +3,9 @@
 #ifdef BOTAN_FOUND
 
 #include <fstream>
+#include <map>
+
+#include <sys/stat.h>
 
 #include <utils/tolower.hpp>
 
@@ -49,4 +52,80 @@ bool BiboumiTLSPolicy::require_cert_revocation_info() const
   return this->req_cert_revocation_info;
 }
 
+namespace
+{
+  /**
+   * Identifies the content of a file: its modification time (including
+   * the nanoseconds, since a file can be written twice in the same second)
+   * and its size.
+   */
+  struct FileVersion
+  {
+    bool exists;
+    struct timespec mtime;
+    off_t size;
+
+    bool operator==(const FileVersion& other) const
+    {
+      return this->exists == other.exists && this->mtime.tv_sec == other.mtime.tv_sec &&
+          this->mtime.tv_nsec == other.mtime.tv_nsec && this->size == other.size;
+    }
+    bool operator!=(const FileVersion& other) const
+    {
+      return !(*this == other);
+    }
+  };
+
+  FileVersion get_version(const std::string& filename)
+  {
+    struct stat st;
+    if (::stat(filename.data(), &st) == -1)
+      return {false, {}, 0};
+    return {true, st.st_mtim, st.st_size};
+  }
+
+  struct CachedPolicy
+  {
+    std::shared_ptr<const BiboumiTLSPolicy> policy;
+    FileVersion global_version;
+    FileVersion specific_version;
+  };
+
+  /**
+   * Indexed by the path of the address-specific policy file, or by an
+   * empty string for the addresses without one, which all share the same
+   * object
+   */
+  std::map<std::string, CachedPolicy> policies_cache;
+}
+
+std::shared_ptr<const BiboumiTLSPolicy> get_tls_policy(const std::string& directory, const std::string& address)
+{
+  const auto global_path = directory + "policy.txt";
+  auto specific_path = directory + address + ".policy.txt";
+  const auto global_version = get_version(global_path);
+  const auto specific_version = get_version(specific_path);
+  if (!specific_version.exists)
+    specific_path.clear();
+
+  auto& cached = policies_cache[specific_path];
+  if (cached.policy && cached.global_version == global_version && cached.specific_version == specific_version)
+    return cached.policy;
+
+  auto policy = std::make_shared<BiboumiTLSPolicy>();
+  if (global_version.exists)
+    policy->load(global_path);
+  if (!specific_path.empty())
+    policy->load(specific_path);
+  cached.policy = std::move(policy);
+  cached.global_version = global_version;
+  cached.specific_version = specific_version;
+  return cached.policy;
+}
+
+void clear_tls_policy_cache()
+{
+  policies_cache.clear();
+}
+
 #endif
@@ -6,6 +6,9 @@
 
 #include <botan/tls_policy.h>
 
+#include <memory>
+#include <string>
+
 class BiboumiTLSPolicy: public Botan::TLS::Text_Policy
 {
 public:
@@ -26,4 +29,17 @@ protected:
   bool req_cert_revocation_info{true};
 };
 
+/**
+ * Return the policy to use for connections to the given address: the
+ * global policy.txt file, and then the <address>.policy.txt one, loaded
+ * from the given directory.
+ *
+ * The parsed policies are kept in a process-wide cache, and shared by all
+ * the connections using them. A file is parsed again only if its
+ * modification time (with nanoseconds) or size changes, or after
+ * clear_tls_policy_cache().
+ */
+std::shared_ptr<const BiboumiTLSPolicy> get_tls_policy(const std::string& directory, const std::string& address);
+void clear_tls_policy_cache();
+
 #endif
@@ -12,6 +12,10 @@
 #include <map>
 #include <bitset>
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 /**
  * The UTF-8-encoded character used as a place holder when a character conversion fails.
  * This is U+FFFD � "replacement character"
@@ -82,7 +86,7 @@ namespace utils
     char* r = res.data();
 
     const unsigned char* str = reinterpret_cast<const unsigned char*>(original.c_str());
-    std::bitset<20> codepoint;
+    std::bitset<21> codepoint;
 
     while (*str)
       {
@@ -143,6 +147,41 @@ namespace utils
     return {res.data(), static_cast<size_t>(r - res.data())};
   }
 
+  static bool is_xml_safe(const unsigned char c)
+  {
+    return c >= 0x20 && c < 0x80 && c != '&' && c != '<' && c != '>' && c != '\"' && c != '\'';
+  }
+
+  std::size_t xml_safe_prefix_size(const char* data, const std::size_t size)
+  {
+    std::size_t pos = 0;
+#ifdef __SSE2__
+    // The chars are signed: everything that is not ASCII is also below 0x20
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8('\"');
+    const __m128i apos = _mm_set1_epi8('\'');
+    for (; pos + 16 <= size; pos += 16)
+      {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        __m128i unsafe = _mm_cmplt_epi8(chunk, space);
+        unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(chunk, amp));
+        unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(chunk, lt));
+        unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(chunk, gt));
+        unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(chunk, quot));
+        unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(chunk, apos));
+        const auto mask = static_cast<unsigned int>(_mm_movemask_epi8(unsafe));
+        if (mask != 0)
+          return pos + static_cast<std::size_t>(__builtin_ctz(mask));
+      }
+#endif
+    while (pos < size && is_xml_safe(static_cast<unsigned char>(data[pos])))
+      ++pos;
+    return pos;
+  }
+
   std::string convert_to_utf8(const std::string& str, const char* charset)
   {
     std::string res;
@@ -24,6 +24,13 @@ namespace utils
    * in XML.
    */
   std::string remove_invalid_xml_chars(const std::string& original);
+  /**
+   * Return the number of chars, at the beginning of the given data, that
+   * can be copied as is in an XML document: the printable ASCII chars,
+   * except the ones that need to be escaped (&<>"'). On x86, 16 chars are
+   * checked at once.
+   */
+  std::size_t xml_safe_prefix_size(const char* data, const std::size_t size);
   /**
    * Convert the given string (encoded is "encoding") into valid utf-8.
    * If some decoding fails, insert an utf-8 placeholder character instead.
@@ -3,9 +3,14 @@
 #include <config/config.hpp>
 #include <utils/xdg.hpp>
 #include <logger/logger.hpp>
+#include <network/dns_cache.hpp>
 
 #include "biboumi.h"
 
+#ifdef BOTAN_FOUND
+# include <network/tls_policy.hpp>
+#endif
+
 void open_database()
 {
 #ifdef USE_DATABASE
@@ -23,6 +28,12 @@ void reload_process()
   // line needs to be written
   Logger::instance().reset();
   log_info("Configuration and logger reloaded.");
+#ifdef BOTAN_FOUND
+  // The policy files are read again on the next TLS connection
+  clear_tls_policy_cache();
+#endif
+  // Also a way to forget the DNS records that changed
+  DnsCache::instance().clear();
 #ifdef USE_DATABASE
   try {
       open_database();
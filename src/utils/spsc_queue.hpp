@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace utils
+{
+
+/**
+ * A bounded, lock-free, single-producer single-consumer queue.
+ *
+ * push() must only be called by one thread, and pop() by one (other)
+ * thread. Neither of them ever blocks: push() returns false if the queue is
+ * full, pop() returns false if it is empty.
+ *
+ * The capacity is rounded up to the next power of two.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+  explicit SpscQueue(const std::size_t min_capacity):
+    buffer(round_up_capacity(min_capacity)),
+    mask(buffer.size() - 1),
+    head(0),
+    cached_tail(0),
+    tail(0),
+    cached_head(0)
+  {}
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue(SpscQueue&&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+  SpscQueue& operator=(SpscQueue&&) = delete;
+
+  /**
+   * Producer side.
+   */
+  bool push(T&& value)
+  {
+    const auto tail = this->tail.load(std::memory_order_relaxed);
+    if (tail - this->cached_head == this->buffer.size())
+      {
+        this->cached_head = this->head.load(std::memory_order_acquire);
+        if (tail - this->cached_head == this->buffer.size())
+          return false;
+      }
+    this->buffer[tail & this->mask] = std::move(value);
+    this->tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+  /**
+   * Consumer side.
+   */
+  bool pop(T& value)
+  {
+    const auto head = this->head.load(std::memory_order_relaxed);
+    if (head == this->cached_tail)
+      {
+        this->cached_tail = this->tail.load(std::memory_order_acquire);
+        if (head == this->cached_tail)
+          return false;
+      }
+    auto& slot = this->buffer[head & this->mask];
+    value = std::move(slot);
+    // Do not keep whatever the moved-from value still owns until the slot
+    // is reused
+    slot = T{};
+    this->head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  /**
+   * Only a hint, when called by a thread that is neither the producer nor
+   * the consumer.
+   */
+  bool empty() const
+  {
+    return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_acquire);
+  }
+  std::size_t capacity() const
+  {
+    return this->buffer.size();
+  }
+
+private:
+  static std::size_t round_up_capacity(const std::size_t min_capacity)
+  {
+    std::size_t capacity = 2;
+    while (capacity < min_capacity)
+      capacity *= 2;
+    return capacity;
+  }
+
+  std::vector<T> buffer;
+  const std::size_t mask;
+  /**
+   * The consumer’s position, and its copy of the producer’s one. They are
+   * kept away from the producer’s ones, to avoid false sharing.
+   */
+  alignas(64) std::atomic<std::size_t> head;
+  std::size_t cached_tail;
+  alignas(64) std::atomic<std::size_t> tail;
+  std::size_t cached_head;
+};
+
+}
@@ -2,21 +2,27 @@
 #include <utils/timed_events.hpp>
 
 TimedEvent::TimedEvent(std::chrono::steady_clock::time_point&& time_point,
-                       std::function<void()> callback, std::string name):
+                       std::function<void()> callback, std::string name,
+                       std::chrono::milliseconds slack):
   time_point(time_point),
   callback(std::move(callback)),
   repeat(false),
   repeat_delay(0),
+  slack(slack),
+  sequence(0),
   name(std::move(name))
 {
 }
 
 TimedEvent::TimedEvent(std::chrono::milliseconds&& duration,
-                       std::function<void()> callback, std::string name):
+                       std::function<void()> callback, std::string name,
+                       std::chrono::milliseconds slack):
   time_point(std::chrono::steady_clock::now() + duration),
   callback(std::move(callback)),
   repeat(true),
   repeat_delay(duration),
+  slack(slack),
+  sequence(0),
   name(std::move(name))
 {
 }
@@ -37,6 +43,11 @@ std::chrono::milliseconds TimedEvent::get_timeout() const
   return std::max(diff, 0ms);
 }
 
+std::chrono::steady_clock::time_point TimedEvent::get_deadline() const
+{
+  return this->time_point + this->slack;
+}
+
 void TimedEvent::execute() const
 {
   this->callback();
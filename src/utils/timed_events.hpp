@@ -1,6 +1,8 @@
 #pragma once
 
+#include <unordered_map>
 #include <functional>
+#include <cstdint>
 #include <string>
 #include <chrono>
 #include <vector>
@@ -13,6 +15,12 @@ static constexpr std::chrono::milliseconds no_timeout = std::chrono::millisecond
 
 class TimedEventsManager;
 
+/**
+ * Identifies an event added to the TimedEventsManager, to cancel it
+ * without knowing (or giving) its name. 0 is never a valid handle.
+ */
+using TimedEventHandle = std::uint64_t;
+
 /**
  * A callback with an associated date.
  */
@@ -23,11 +31,16 @@ class TimedEvent
 public:
   /**
    * An event the occurs only once, at the given time_point
+   *
+   * The event may be executed up to slack later than its time point, so
+   * that it can be executed in the same wakeup as other events.
    */
   explicit TimedEvent(std::chrono::steady_clock::time_point&& time_point,
-                      std::function<void()> callback, std::string name="");
+                      std::function<void()> callback, std::string name="",
+                      std::chrono::milliseconds slack=0ms);
   explicit TimedEvent(std::chrono::milliseconds&& duration,
-                      std::function<void()> callback, std::string name="");
+                      std::function<void()> callback, std::string name="",
+                      std::chrono::milliseconds slack=0ms);
 
   explicit TimedEvent(TimedEvent&&) = default;
   TimedEvent& operator=(TimedEvent&&) = default;
@@ -47,6 +60,10 @@ public:
    * returned value is 0 instead. The value cannot then be negative.
    */
   std::chrono::milliseconds get_timeout() const;
+  /**
+   * The latest time at which the event should be executed.
+   */
+  std::chrono::steady_clock::time_point get_deadline() const;
   void execute() const;
   const std::string& get_name() const;
 
@@ -68,6 +85,12 @@ private:
    * if repeat is true. Otherwise it is ignored.
    */
   std::chrono::milliseconds repeat_delay;
+  std::chrono::milliseconds slack;
+  /**
+   * The sequence of the last entry added for this event in the heaps of
+   * the TimedEventsManager. The other entries are stale.
+   */
+  std::uint64_t sequence;
   /**
    * A name that is used to identify that event. If you want to find your
    * event (for example if you want to cancel it), the name should be
@@ -78,7 +101,16 @@ private:
 
 /**
  * A class managing a list of TimedEvents.
- * They are sorted, new events can be added, removed, fetch, etc.
+ *
+ * The events are kept in a binary heap, ordered by expiration time (and
+ * insertion order, for the events expiring at the same time). Cancelling
+ * an event only removes it from the events map: its entry stays in the
+ * heap and is skipped when it reaches the top.  The events with a name
+ * are also indexed by that name.
+ *
+ * A second heap orders them by deadline (expiration time plus slack): we
+ * only need to wake up at the first deadline, and then execute all the
+ * events that have expired in the meantime.
  */
 
 class TimedEventsManager
@@ -96,10 +128,11 @@ public:
    */
   static TimedEventsManager& instance();
   /**
-   * Add an event to the list of managed events. The list is sorted after
-   * this call.
+   * Add an event to the list of managed events, and return a handle that
+   * can be used to cancel it. The handle stays valid across the
+   * repetitions of the event.
    */
-  void add_event(TimedEvent&& event);
+  TimedEventHandle add_event(TimedEvent&& event);
   /**
    * Returns the duration, in milliseconds, between now and the next
    * available event. If the event is already expired (the duration is
@@ -108,6 +141,11 @@ public:
    * Returns a negative value if no event is available.
    */
   std::chrono::milliseconds get_timeout() const;
+  /**
+   * The time at which we need to wake up to execute the next events, or
+   * time_point::max() if there is no event.
+   */
+  std::chrono::steady_clock::time_point get_next_deadline() const;
   /**
    * Execute all the expired events (if their expiration time is exactly
    * now, or before now). The event is then removed from the list. If the
@@ -121,6 +159,11 @@ public:
    * Returns the number of canceled events.
    */
   std::size_t cancel(const std::string& name);
+  /**
+   * Remove the event with this handle. Returns false if it does not
+   * exist anymore (already executed, or cancelled).
+   */
+  bool cancel(const TimedEventHandle handle);
   /**
    * Return the number of managed events.
    */
@@ -130,8 +173,39 @@ public:
    * is found, returns nullptr.
    */
   const TimedEvent* find_event(const std::string& name) const;
+  const TimedEvent* find_event(const TimedEventHandle handle) const;
 
 private:
-  std::vector<TimedEvent> events;
   explicit TimedEventsManager() = default;
+
+  struct HeapEntry
+  {
+    std::chrono::steady_clock::time_point time_point;
+    /**
+     * Increases with each insertion, to keep the events expiring at the
+     * same time in the order they were added.
+     */
+    std::uint64_t sequence;
+    TimedEventHandle handle;
+  };
+  struct HeapEntryCompare
+  {
+    bool operator()(const HeapEntry& a, const HeapEntry& b) const;
+  };
+  void push(const TimedEventHandle handle, TimedEvent& event);
+  bool is_stale(const HeapEntry& entry) const;
+  /**
+   * Remove the stale entries (of the cancelled or executed events) from the
+   * top of the heap, so that the top is the next event to execute. If too
+   * many of them are left in the heap, rebuild it without them.
+   */
+  void clean_heap(std::vector<HeapEntry>& entries) const;
+  void remove_name(const std::string& name, const TimedEventHandle handle);
+
+  std::unordered_map<TimedEventHandle, TimedEvent> events;
+  std::unordered_multimap<std::string, TimedEventHandle> names;
+  mutable std::vector<HeapEntry> heap;
+  mutable std::vector<HeapEntry> deadlines;
+  TimedEventHandle last_handle{0};
+  std::uint64_t last_sequence{0};
 };
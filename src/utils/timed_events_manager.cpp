@@ -8,68 +8,149 @@ TimedEventsManager& TimedEventsManager::instance()
   return inst;
 }
 
-void TimedEventsManager::add_event(TimedEvent&& event)
+bool TimedEventsManager::HeapEntryCompare::operator()(const HeapEntry& a, const HeapEntry& b) const
 {
-  for (auto it = this->events.begin(); it != this->events.end(); ++it)
+  // std::push_heap and friends build a max-heap, so the “biggest” entry is
+  // the one that expires first
+  if (a.time_point != b.time_point)
+    return a.time_point > b.time_point;
+  return a.sequence > b.sequence;
+}
+
+TimedEventHandle TimedEventsManager::add_event(TimedEvent&& event)
+{
+  const auto handle = ++this->last_handle;
+  if (!event.name.empty())
+    this->names.emplace(event.name, handle);
+  auto it = this->events.emplace(handle, std::move(event)).first;
+  this->push(handle, it->second);
+  return handle;
+}
+
+void TimedEventsManager::push(const TimedEventHandle handle, TimedEvent& event)
+{
+  event.sequence = ++this->last_sequence;
+  this->heap.push_back({event.time_point, event.sequence, handle});
+  std::push_heap(this->heap.begin(), this->heap.end(), HeapEntryCompare{});
+  this->deadlines.push_back({event.get_deadline(), event.sequence, handle});
+  std::push_heap(this->deadlines.begin(), this->deadlines.end(), HeapEntryCompare{});
+}
+
+bool TimedEventsManager::is_stale(const HeapEntry& entry) const
+{
+  const auto it = this->events.find(entry.handle);
+  return it == this->events.end() || it->second.sequence != entry.sequence;
+}
+
+void TimedEventsManager::clean_heap(std::vector<HeapEntry>& entries) const
+{
+  if (entries.size() > 64 && entries.size() > 2 * this->events.size())
     {
-      if (it->is_after(event))
-        {
-          this->events.emplace(it, std::move(event));
-          return;
-        }
+      entries.erase(std::remove_if(entries.begin(), entries.end(), [this](const HeapEntry& entry) {
+                      return this->is_stale(entry);
+                    }), entries.end());
+      std::make_heap(entries.begin(), entries.end(), HeapEntryCompare{});
     }
-  this->events.emplace_back(std::move(event));
+  while (!entries.empty() && this->is_stale(entries.front()))
+    {
+      std::pop_heap(entries.begin(), entries.end(), HeapEntryCompare{});
+      entries.pop_back();
+    }
+}
+
+std::chrono::steady_clock::time_point TimedEventsManager::get_next_deadline() const
+{
+  this->clean_heap(this->deadlines);
+  if (this->deadlines.empty())
+    return std::chrono::steady_clock::time_point::max();
+  return this->deadlines.front().time_point;
 }
 
 std::chrono::milliseconds TimedEventsManager::get_timeout() const
 {
-  if (this->events.empty())
+  const auto deadline = this->get_next_deadline();
+  if (deadline == std::chrono::steady_clock::time_point::max())
     return utils::no_timeout;
-  return this->events.front().get_timeout();
+  // Rounded up, to not wake up right before the deadline
+  const auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now() + 999us);
+  return std::max(diff, 0ms);
 }
 
 std::size_t TimedEventsManager::execute_expired_events()
 {
   std::size_t count = 0;
   const auto now = std::chrono::steady_clock::now();
-  for (auto it = this->events.begin(); it != this->events.end();)
+  while (true)
     {
-      if (!it->is_after(now))
+      this->clean_heap(this->heap);
+      if (this->heap.empty() || this->heap.front().time_point > now)
+        break;
+      const auto handle = this->heap.front().handle;
+      std::pop_heap(this->heap.begin(), this->heap.end(), HeapEntryCompare{});
+      this->heap.pop_back();
+
+      auto it = this->events.find(handle);
+      ++count;
+      if (!it->second.repeat)
         {
-          TimedEvent copy(std::move(*it));
-          it = this->events.erase(it);
-          ++count;
-          copy.execute();
-          if (copy.repeat)
-            {
-              copy.time_point += copy.repeat_delay;
-              this->add_event(std::move(copy));
-            }
+          TimedEvent event(std::move(it->second));
+          this->events.erase(it);
+          this->remove_name(event.name, handle);
+          event.execute();
           continue;
         }
-      else
-        break;
+      // A repeated event stays managed during its callback, which may
+      // cancel it. Only the callback is moved out, to not be destroyed
+      // while it’s running.
+      auto callback = std::move(it->second.callback);
+      callback();
+      it = this->events.find(handle);
+      if (it != this->events.end())
+        {
+          it->second.callback = std::move(callback);
+          it->second.time_point += it->second.repeat_delay;
+          this->push(handle, it->second);
+        }
     }
   return count;
 }
 
+void TimedEventsManager::remove_name(const std::string& name, const TimedEventHandle handle)
+{
+  if (name.empty())
+    return;
+  const auto range = this->names.equal_range(name);
+  for (auto it = range.first; it != range.second; ++it)
+    if (it->second == handle)
+      {
+        this->names.erase(it);
+        return;
+      }
+}
+
 std::size_t TimedEventsManager::cancel(const std::string& name)
 {
   std::size_t res = 0;
-  for (auto it = this->events.begin(); it != this->events.end();)
+  const auto range = this->names.equal_range(name);
+  for (auto it = range.first; it != range.second; ++it)
     {
-      if (it->get_name() == name)
-        {
-          it = this->events.erase(it);
-          res++;
-        }
-      else
-        ++it;
+      this->events.erase(it->second);
+      res++;
     }
+  this->names.erase(range.first, range.second);
   return res;
 }
 
-
+bool TimedEventsManager::cancel(const TimedEventHandle handle)
+{
+  auto it = this->events.find(handle);
+  if (it == this->events.end())
+    return false;
+  this->remove_name(it->second.get_name(), handle);
+  this->events.erase(it);
+  return true;
+}
 
 std::size_t TimedEventsManager::size() const
 {
@@ -78,10 +159,20 @@ std::size_t TimedEventsManager::size() const
 
 const TimedEvent* TimedEventsManager::find_event(const std::string& name) const
 {
-  const auto it = std::find_if(this->events.begin(), this->events.end(), [&name](const TimedEvent& o) {
-    return o.get_name() == name;
-  });
+  const auto range = this->names.equal_range(name);
+  for (auto it = range.first; it != range.second; ++it)
+    {
+      const auto event = this->find_event(it->second);
+      if (event)
+        return event;
+    }
+  return nullptr;
+}
+
+const TimedEvent* TimedEventsManager::find_event(const TimedEventHandle handle) const
+{
+  const auto it = this->events.find(handle);
   if (it == this->events.end())
     return nullptr;
-  return &*it;
+  return &it->second;
 }
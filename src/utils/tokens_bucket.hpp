@@ -1,12 +1,15 @@
 /**
  * Implementation of the token bucket algorithm.
  *
- * It uses a repetitive TimedEvent, started at construction, to fill the
- * bucket.
+ * A token is added every fill_duration, up to the limit. The tokens are
+ * not added by a timer: their number is computed from the time elapsed
+ * since the last refill, when we need it.
  *
- * Every n seconds, it executes the given callback. If the callback
- * returns true, we add a token (if the limit is not yet reached).
+ * When no token is available, the user can call wait_for_token(): a single
+ * TimedEvent is then scheduled to call the given callback when the next
+ * token becomes available. Nothing happens when nobody is waiting.
  *
+ * A negative limit means there is no limit.
  */
 
 #pragma once
@@ -14,23 +17,38 @@
 #include <utils/timed_events.hpp>
 #include <logger/logger.hpp>
 
+#include <functional>
+#include <chrono>
+
 class TokensBucket
 {
 public:
-  TokensBucket(long int max_size, std::chrono::milliseconds fill_duration, std::function<bool()> callback, std::string name):
+  TokensBucket(long int max_size, std::chrono::milliseconds fill_duration, std::function<void()> callback):
       limit(max_size),
-      tokens(static_cast<std::size_t>(limit)),
-      callback(std::move(callback))
+      tokens(max_size < 0 ? 0 : static_cast<std::size_t>(max_size)),
+      fill_duration(fill_duration),
+      last_refill(std::chrono::steady_clock::now()),
+      callback(std::move(callback)),
+      event(0)
   {
     log_debug("creating TokensBucket with max size: ", max_size);
-    TimedEvent event(std::move(fill_duration), [this]() { this->add_token(); }, std::move(name));
-    TimedEventsManager::instance().add_event(std::move(event));
   }
 
+  ~TokensBucket()
+  {
+    TimedEventsManager::instance().cancel(this->event);
+  }
+
+  TokensBucket(const TokensBucket&) = delete;
+  TokensBucket(TokensBucket&&) = delete;
+  TokensBucket& operator=(const TokensBucket&) = delete;
+  TokensBucket& operator=(TokensBucket&&) = delete;
+
   bool use_token()
   {
     if (this->limit < 0)
       return true;
+    this->refill();
     if (this->tokens > 0)
       {
         this->tokens--;
@@ -40,21 +58,71 @@ public:
       return false;
   }
 
+  /**
+   * Call the callback once the next token is available (or right away, if
+   * there is no limit anymore). The callback does not get that token, it
+   * has to call use_token().
+   */
+  void wait_for_token()
+  {
+    if (this->event != 0)
+      return;
+    auto time_point = std::chrono::steady_clock::now();
+    if (this->limit >= 0)
+      {
+        this->refill();
+        if (this->tokens == 0)
+          time_point = this->last_refill + this->fill_duration;
+      }
+    this->event = TimedEventsManager::instance().add_event(
+        TimedEvent(std::move(time_point), [this]() {
+            this->event = 0;
+            this->callback();
+          }));
+  }
+
   void set_limit(long int limit)
   {
+    this->refill();
     this->limit = limit;
+    if (this->limit >= 0 && this->tokens > static_cast<std::size_t>(this->limit))
+      this->tokens = static_cast<std::size_t>(this->limit);
   }
 
 private:
   long int limit;
   std::size_t tokens;
-  std::function<bool()> callback;
+  const std::chrono::milliseconds fill_duration;
+  /**
+   * The time at which the last token was added. Once the bucket is full,
+   * the time of the last refill.
+   */
+  std::chrono::steady_clock::time_point last_refill;
+  std::function<void()> callback;
+  /**
+   * The event calling the callback, if someone is waiting for a token
+   */
+  TimedEventHandle event;
 
-  void add_token()
+  void refill()
   {
+    const auto now = std::chrono::steady_clock::now();
     if (this->limit < 0)
-      return;
-    if (this->callback() && this->tokens != static_cast<decltype(this->tokens)>(this->limit))
-      this->tokens++;
+      {
+        this->last_refill = now;
+        return;
+      }
+    const auto max = static_cast<std::size_t>(this->limit);
+    const auto count = (now - this->last_refill) / this->fill_duration;
+    if (this->tokens >= max || this->tokens + static_cast<std::size_t>(count) >= max)
+      {
+        this->tokens = max;
+        this->last_refill = now;
+      }
+    else if (count > 0)
+      {
+        this->tokens += static_cast<std::size_t>(count);
+        this->last_refill += count * this->fill_duration;
+      }
   }
 };
@@ -59,7 +59,7 @@ XmlNode AdhocCommandsHandler::handle_request(const std::string& executor_jid, co
                                  std::forward_as_tuple(command_it->second, executor_jid, to));
           TimedEventsManager::instance().add_event(TimedEvent(std::chrono::steady_clock::now() + 3600s,
                                                               std::bind(&AdhocCommandsHandler::remove_session, this, sessionid, executor_jid),
-                                                              "adhocsession" + sessionid + executor_jid));
+                                                              "adhocsession" + sessionid + executor_jid, 60s));
         }
       auto session_it = this->sessions.find(std::make_pair(sessionid, executor_jid));
       if ((session_it != this->sessions.end()) &&
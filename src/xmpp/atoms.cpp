@@ -0,0 +1,69 @@
+#include <xmpp/atoms.hpp>
+#include <xmpp/xmpp_component.hpp>
+
+#include <unordered_map>
+#include <array>
+
+namespace
+{
+  // In the same order as the enum
+  const std::array<std::string, atoms::count> strings = {{
+      "",
+      STREAM_NS,
+      COMPONENT_NS,
+      MUC_NS,
+      MUC_USER_NS,
+      MUC_ADMIN_NS,
+      MUC_OWNER_NS,
+      DISCO_NS,
+      DISCO_ITEMS_NS,
+      DISCO_INFO_NS,
+      XHTMLIM_NS,
+      STANZA_NS,
+      STREAMS_NS,
+      VERSION_NS,
+      ADHOC_NS,
+      PING_NS,
+      DELAY_NS,
+      MAM_NS,
+      FORWARD_NS,
+      CLIENT_NS,
+      DATAFORM_NS,
+      RSM_NS,
+      MUC_TRAFFIC_NS,
+      STABLE_ID_NS,
+      STABLE_MUC_ID_NS,
+      "message",
+      "presence",
+      "iq",
+      "handshake",
+      "error",
+    }};
+
+  std::unordered_map<std::string, Atom> make_atoms()
+  {
+    std::unordered_map<std::string, Atom> res;
+    for (std::size_t i = 1; i < strings.size(); ++i)
+      res.emplace(strings[i], static_cast<Atom>(i));
+    return res;
+  }
+}
+
+namespace atoms
+{
+  Atom find(const std::string& str)
+  {
+    static const std::unordered_map<std::string, Atom> table = make_atoms();
+    const auto it = table.find(str);
+    if (it == table.end())
+      return none;
+    return it->second;
+  }
+
+  const std::string& get(const Atom atom)
+  {
+    if (atom >= strings.size())
+      return strings[none];
+    return strings[atom];
+  }
+}
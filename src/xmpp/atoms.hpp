@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * An atom is a small integer standing for one of the XML namespaces (the
+ * *_NS constants of xmpp_component.hpp) or element names that we know
+ * about. Comparing two atoms is a lot cheaper than comparing the strings.
+ *
+ * The list is fixed at compile time: any other string is atoms::none, so
+ * the remote entities cannot make it grow.
+ */
+using Atom = std::uint16_t;
+
+namespace atoms
+{
+  enum : Atom
+  {
+    none,
+    // Namespaces
+    stream_ns,
+    component_ns,
+    muc_ns,
+    muc_user_ns,
+    muc_admin_ns,
+    muc_owner_ns,
+    disco_ns,
+    disco_items_ns,
+    disco_info_ns,
+    xhtmlim_ns,
+    stanza_ns,
+    streams_ns,
+    version_ns,
+    adhoc_ns,
+    ping_ns,
+    delay_ns,
+    mam_ns,
+    forward_ns,
+    client_ns,
+    dataform_ns,
+    rsm_ns,
+    muc_traffic_ns,
+    stable_id_ns,
+    stable_muc_id_ns,
+    // Names of the stanzas
+    message,
+    presence,
+    iq,
+    handshake,
+    error,
+
+    count
+  };
+
+  /**
+   * Return the atom of that string, or atoms::none if it is not in the
+   * table
+   */
+  Atom find(const std::string& str);
+  /**
+   * Return the string of that atom (an empty string for atoms::none)
+   */
+  const std::string& get(const Atom atom);
+}
@@ -2,6 +2,8 @@
 #include <xmpp/biboumi_component.hpp>
 #include <utils/scopeguard.hpp>
 #include <bridge/bridge.hpp>
+#include <irc/connection_scheduler.hpp>
+#include <network/dns_cache.hpp>
 #include <config/config.hpp>
 #include <utils/string.hpp>
 #include <utils/split.hpp>
@@ -883,6 +885,20 @@ void DisconnectUserFromServerStep3(XmppComponent& xmpp_component, AdhocSession&
   note.set_inner(msg);
 }
 
+void GetDnsCacheInfoStep1(XmppComponent&, AdhocSession&, XmlNode& command_node)
+{
+  const auto& cache = DnsCache::instance();
+  std::ostringstream ss;
+  ss << cache.size() << " hostnames in the DNS cache. "
+     << cache.get_hits() << " resolutions answered from the cache, "
+     << cache.get_misses() << " not found in the cache.";
+
+  command_node.delete_all_children();
+  XmlSubNode note(command_node, "note");
+  note["type"] = "info";
+  note.set_inner(ss.str());
+}
+
 void GetIrcConnectionInfoStep1(XmppComponent& component, AdhocSession& session, XmlNode& command_node)
 {
   auto& biboumi_component = dynamic_cast<BiboumiComponent&>(component);
@@ -913,6 +929,13 @@ void GetIrcConnectionInfoStep1(XmppComponent& component, AdhocSession& session,
     hostname = target.local;
 
   IrcClient* irc = bridge->find_irc_client(hostname);
+  if (irc && irc->is_connection_scheduled())
+    {
+      message = "Waiting to connect to the IRC server " + hostname + " (" +
+          std::to_string(ConnectionScheduler::instance().queue_size(hostname)) + " connections queued, " +
+          std::to_string(ConnectionScheduler::instance().in_progress(hostname)) + " in progress).";
+      return;
+    }
   if (!irc || !irc->is_connected())
     {
       message = "You are not connected to the IRC server " + hostname;
@@ -935,6 +958,11 @@ void GetIrcConnectionInfoStep1(XmppComponent& component, AdhocSession& session,
     ss << " since " << buf;
 #endif
   ss << " (" << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - irc->connection_date).count() << " seconds ago).";
+  if (irc->get_output_size() > 0)
+    ss << "\n" << irc->get_output_size() << " bytes waiting to be sent to the IRC server.";
+  if (irc->is_recv_paused())
+    ss << "\nReading from the IRC server is paused, because the XMPP server is too slow ("
+       << biboumi_component.get_output_size() << " bytes waiting to be sent to it).";
 
   for (const auto& it: bridge->resources_in_chan)
     {
@@ -26,4 +26,6 @@ void DisconnectUserFromServerStep1(XmppComponent&, AdhocSession& session, XmlNod
 void DisconnectUserFromServerStep2(XmppComponent&, AdhocSession& session, XmlNode& command_node);
 void DisconnectUserFromServerStep3(XmppComponent&, AdhocSession& session, XmlNode& command_node);
 
+void GetDnsCacheInfoStep1(XmppComponent&, AdhocSession& session, XmlNode& command_node);
+
 void GetIrcConnectionInfoStep1(XmppComponent&, AdhocSession& session, XmlNode& command_node);
@@ -13,6 +13,7 @@
 #include <xmpp/jid.hpp>
 
 #include <stdexcept>
+#include <algorithm>
 #include <iostream>
 
 #include <cstdlib>
@@ -48,18 +49,25 @@ BiboumiComponent::BiboumiComponent(std::shared_ptr<Poller>& poller, const std::s
   irc_server_adhoc_commands_handler(*this),
   irc_channel_adhoc_commands_handler(*this)
 {
-  this->stanza_handlers.emplace("presence",
+  this->stanza_handlers.emplace(atoms::presence,
                                 std::bind(&BiboumiComponent::handle_presence, this,std::placeholders::_1));
-  this->stanza_handlers.emplace("message",
+  this->stanza_handlers.emplace(atoms::message,
                                 std::bind(&BiboumiComponent::handle_message, this,std::placeholders::_1));
-  this->stanza_handlers.emplace("iq",
+  this->stanza_handlers.emplace(atoms::iq,
                                 std::bind(&BiboumiComponent::handle_iq, this,std::placeholders::_1));
 
+  const auto high_watermark = Config::get_int("xmpp_output_high_watermark", 16 * 1024 * 1024);
+  const auto low_watermark = Config::get_int("xmpp_output_low_watermark", 4 * 1024 * 1024);
+  if (high_watermark > 0)
+    this->set_output_watermarks(static_cast<std::size_t>(high_watermark),
+                                static_cast<std::size_t>(std::max(low_watermark, 0)));
+
   this->adhoc_commands_handler.add_command("ping", {{&PingStep1}, "Do a ping", false});
   this->adhoc_commands_handler.add_command("hello", {{&HelloStep1, &HelloStep2}, "Receive a custom greeting", false});
   this->adhoc_commands_handler.add_command("disconnect-user", {{&DisconnectUserStep1, &DisconnectUserStep2}, "Disconnect selected users from the gateway", true});
   this->adhoc_commands_handler.add_command("disconnect-from-irc-server", {{&DisconnectUserFromServerStep1, &DisconnectUserFromServerStep2, &DisconnectUserFromServerStep3}, "Disconnect from the selected IRC servers", false});
   this->adhoc_commands_handler.add_command("reload", {{&Reload}, "Reload biboumi’s configuration", true});
+  this->adhoc_commands_handler.add_command("get-dns-cache-info", {{&GetDnsCacheInfoStep1}, "Returns the statistics of the DNS cache", true});
 
   AdhocCommand get_irc_connection_info{{&GetIrcConnectionInfoStep1}, "Returns various information about your connection to this IRC server.", false};
   if (!Config::get("fixed_irc_server", "").empty())
@@ -137,6 +145,7 @@ void BiboumiComponent::handle_presence(const Stanza& stanza)
   Jid to(to_str);
   Jid from(from_str);
   Iid iid(to.local, bridge);
+  const LogContext log_context(from_str, iid.get_server());
 
   // An error stanza is sent whenever we exit this function without
   // disabling this scopeguard.  If error_type and error_name are not
@@ -157,13 +166,13 @@ void BiboumiComponent::handle_presence(const Stanza& stanza)
       if (type.empty())
         {
           const std::string own_nick = bridge->get_own_nick(iid);
-          const XmlNode* x = stanza.get_child("x", MUC_NS);
+          const XmlNode* x = stanza.get_child("x", atoms::muc_ns);
           const IrcClient* irc = bridge->find_irc_client(iid.get_server());
           // if there is no <x/>, this is a presence status update, we don’t care about those
           if (x)
             {
-              const XmlNode* password = x->get_child("password", MUC_NS);
-              const XmlNode* history = x->get_child("history", MUC_NS);
+              const XmlNode* password = x->get_child("password", atoms::muc_ns);
+              const XmlNode* history = x->get_child("history", atoms::muc_ns);
               HistoryLimit history_limit;
               if (history)
                 {
@@ -206,7 +215,7 @@ void BiboumiComponent::handle_presence(const Stanza& stanza)
         }
       else if (type == "unavailable")
         {
-          const XmlNode* status = stanza.get_child("status", COMPONENT_NS);
+          const XmlNode* status = stanza.get_child("status", atoms::component_ns);
           bridge->leave_irc_channel(std::move(iid), status ? status->get_inner() : "", from.resource);
         }
     }
@@ -286,6 +295,7 @@ void BiboumiComponent::handle_message(const Stanza& stanza)
   Jid from(from_str);
   Jid to(to_str);
   Iid iid(to.local, bridge);
+  const LogContext log_context(from_str, iid.get_server());
 
   std::string error_type("cancel");
   std::string error_name("internal-server-error");
@@ -294,7 +304,7 @@ void BiboumiComponent::handle_message(const Stanza& stanza)
       this->send_stanza_error("message", from_str, to_str, id,
                               error_type, error_name, error_text);
     });
-  const XmlNode* body = stanza.get_child("body", COMPONENT_NS);
+  const XmlNode* body = stanza.get_child("body", atoms::component_ns);
 
   try {                         // catch IRCNotConnected exceptions
   if (type == "groupchat" && iid.type == Iid::Type::Channel)
@@ -306,11 +316,11 @@ void BiboumiComponent::handle_message(const Stanza& stanza)
               // Extract some XML nodes that we must include in the
               // reflection (if any), because XMPP says so
               std::vector<XmlNode> nodes_to_reflect;
-              const XmlNode* origin_id = stanza.get_child("origin-id", STABLE_ID_NS);
+              const XmlNode* origin_id = stanza.get_child("origin-id", atoms::stable_id_ns);
               if (origin_id)
                 nodes_to_reflect.push_back(*origin_id);
               const auto own_address = std::to_string(iid) + '@' + this->served_hostname;
-              for (const XmlNode* stanza_id: stanza.get_children("stanza-id", STABLE_ID_NS))
+              for (const XmlNode* stanza_id: stanza.get_children("stanza-id", atoms::stable_id_ns))
                 {
                   // Stanza ID generating entities, which encounter a
                   // <stanza-id/> element where the 'by' attribute matches
@@ -330,13 +340,13 @@ void BiboumiComponent::handle_message(const Stanza& stanza)
               return;
             }
         }
-      const XmlNode* subject = stanza.get_child("subject", COMPONENT_NS);
+      const XmlNode* subject = stanza.get_child("subject", atoms::component_ns);
       if (subject)
         bridge->set_channel_topic(iid, subject->get_inner());
     }
   else if (type == "error")
     {
-      const XmlNode* error = stanza.get_child("error", COMPONENT_NS);
+      const XmlNode* error = stanza.get_child("error", atoms::component_ns);
       // Only a set of errors are considered “fatal”. If we encounter one of
       // them, we purge (we disconnect that resource from all the IRC servers)
       // We consider this to be true, unless the error condition is
@@ -379,8 +389,8 @@ void BiboumiComponent::handle_message(const Stanza& stanza)
     }
   else if (type == "normal" && iid.type == Iid::Type::Channel)
     {
-      if (const XmlNode* x = stanza.get_child("x", MUC_USER_NS))
-        if (const XmlNode* invite = x->get_child("invite", MUC_USER_NS))
+      if (const XmlNode* x = stanza.get_child("x", atoms::muc_user_ns))
+        if (const XmlNode* invite = x->get_child("invite", atoms::muc_user_ns))
           {
             const auto invite_to = invite->get_tag("to");
             if (!invite_to.empty())
@@ -448,9 +458,9 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
   if (type == "set")
     {
       const XmlNode* query;
-      if ((query = stanza.get_child("query", MUC_ADMIN_NS)))
+      if ((query = stanza.get_child("query", atoms::muc_admin_ns)))
         {
-          const XmlNode* child = query->get_child("item", MUC_ADMIN_NS);
+          const XmlNode* child = query->get_child("item", atoms::muc_admin_ns);
           if (child)
             {
               std::string nick = child->get_tag("nick");
@@ -462,7 +472,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
                   if (role == "none")
                     {               // This is a kick
                       std::string reason;
-                      const XmlNode* reason_el = child->get_child("reason", MUC_ADMIN_NS);
+                      const XmlNode* reason_el = child->get_child("reason", atoms::muc_admin_ns);
                       if (reason_el)
                         reason = reason_el->get_inner();
                       bridge->send_irc_kick(iid, nick, reason, id, from);
@@ -473,7 +483,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
                 }
             }
         }
-      else if ((query = stanza.get_child("command", ADHOC_NS)))
+      else if ((query = stanza.get_child("command", atoms::adhoc_ns)))
         {
           Stanza response("iq");
           response["to"] = from;
@@ -501,7 +511,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
           // Execute the command, if any, and get a result XmlNode that we
           // insert in our response
           XmlNode inner_node = adhoc_handler->handle_request(from, to_str, *query);
-          if (inner_node.get_child("error", ADHOC_NS))
+          if (inner_node.get_child("error", atoms::adhoc_ns))
             response["type"] = "error";
           else
             response["type"] = "result";
@@ -510,7 +520,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
           stanza_error.disable();
         }
 #ifdef USE_DATABASE
-      else if ((query = stanza.get_child("query", MAM_NS)))
+      else if ((query = stanza.get_child("query", atoms::mam_ns)))
         {
           try {
               if (this->handle_mam_request(stanza))
@@ -520,7 +530,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
               return;
             }
         }
-      else if ((query = stanza.get_child("query", MUC_OWNER_NS)))
+      else if ((query = stanza.get_child("query", atoms::muc_owner_ns)))
         {
           if (this->handle_room_configuration_form(*query, from, to, id))
             stanza_error.disable();
@@ -530,7 +540,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
   else if (type == "get")
     {
       const XmlNode* query;
-      if ((query = stanza.get_child("query", DISCO_INFO_NS)))
+      if ((query = stanza.get_child("query", atoms::disco_info_ns)))
         { // Disco info
           Iid iid(to.local, {'#', '&'});
           const std::string node = query->get_tag("node");
@@ -569,7 +579,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
                 }
             }
         }
-      else if ((query = stanza.get_child("query", VERSION_NS)))
+      else if ((query = stanza.get_child("query", atoms::version_ns)))
         {
           Iid iid(to.local, bridge);
           if ((iid.type == Iid::Type::Channel && !to.resource.empty()) ||
@@ -591,7 +601,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
             }
           stanza_error.disable();
         }
-      else if ((query = stanza.get_child("query", DISCO_ITEMS_NS)))
+      else if ((query = stanza.get_child("query", atoms::disco_items_ns)))
         {
           Iid iid(to.local, bridge);
           const std::string node = query->get_tag("node");
@@ -625,16 +635,16 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
           else if (node.empty() && iid.type == Iid::Type::Server)
             { // Disco on an IRC server: get the list of channels
               ResultSetInfo rs_info;
-              const XmlNode* set_node = query->get_child("set", RSM_NS);
+              const XmlNode* set_node = query->get_child("set", atoms::rsm_ns);
               if (set_node)
                 {
-                  const XmlNode* after = set_node->get_child("after", RSM_NS);
+                  const XmlNode* after = set_node->get_child("after", atoms::rsm_ns);
                   if (after)
                     rs_info.after = after->get_inner();
-                  const XmlNode* before = set_node->get_child("before", RSM_NS);
+                  const XmlNode* before = set_node->get_child("before", atoms::rsm_ns);
                   if (before)
                     rs_info.before = before->get_inner();
-                  const XmlNode* max = set_node->get_child("max", RSM_NS);
+                  const XmlNode* max = set_node->get_child("max", atoms::rsm_ns);
                   if (max)
                     rs_info.max = std::atoi(max->get_inner().data());
                 }
@@ -644,7 +654,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
               stanza_error.disable();
             }
         }
-      else if ((query = stanza.get_child("ping", PING_NS)))
+      else if ((query = stanza.get_child("ping", atoms::ping_ns)))
         {
           Iid iid(to.local, bridge);
           if (iid.type == Iid::Type::User)
@@ -665,7 +675,7 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
           stanza_error.disable();
         }
 #ifdef USE_DATABASE
-      else if ((query = stanza.get_child("query", MUC_OWNER_NS)))
+      else if ((query = stanza.get_child("query", atoms::muc_owner_ns)))
         {
           if (this->handle_room_configuration_form_request(from, to, id))
             stanza_error.disable();
@@ -676,11 +686,11 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
     {
       stanza_error.disable();
       const XmlNode* query;
-      if ((query = stanza.get_child("query", VERSION_NS)))
+      if ((query = stanza.get_child("query", atoms::version_ns)))
         {
-          const XmlNode* name_node = query->get_child("name", VERSION_NS);
-          const XmlNode* version_node = query->get_child("version", VERSION_NS);
-          const XmlNode* os_node = query->get_child("os", VERSION_NS);
+          const XmlNode* name_node = query->get_child("name", atoms::version_ns);
+          const XmlNode* version_node = query->get_child("version", atoms::version_ns);
+          const XmlNode* os_node = query->get_child("os", atoms::version_ns);
           std::string name;
           std::string version;
           std::string os;
@@ -734,7 +744,7 @@ bool BiboumiComponent::handle_mam_request(const Stanza& stanza)
     Jid from(stanza.get_tag("from"));
     Jid to(stanza.get_tag("to"));
 
-    const XmlNode* query = stanza.get_child("query", MAM_NS);
+    const XmlNode* query = stanza.get_child("query", atoms::mam_ns);
 
     Iid iid(to.local, {'#', '&'});
     if (query && iid.type == Iid::Type::Channel && to.resource.empty())
@@ -742,44 +752,44 @@ bool BiboumiComponent::handle_mam_request(const Stanza& stanza)
         const std::string query_id = query->get_tag("queryid");
         std::string start;
         std::string end;
-        const XmlNode* x = query->get_child("x", DATAFORM_NS);
+        const XmlNode* x = query->get_child("x", atoms::dataform_ns);
         if (x)
           {
             const XmlNode* value;
-            const auto fields = x->get_children("field", DATAFORM_NS);
+            const auto fields = x->get_children("field", atoms::dataform_ns);
             for (const auto& field: fields)
               {
                 if (field->get_tag("var") == "start")
                   {
-                    value = field->get_child("value", DATAFORM_NS);
+                    value = field->get_child("value", atoms::dataform_ns);
                     if (value)
                       start = value->get_inner();
                   }
                 else if (field->get_tag("var") == "end")
                   {
-                    value = field->get_child("value", DATAFORM_NS);
+                    value = field->get_child("value", atoms::dataform_ns);
                     if (value)
                       end = value->get_inner();
                   }
               }
           }
-        const XmlNode* set = query->get_child("set", RSM_NS);
+        const XmlNode* set = query->get_child("set", atoms::rsm_ns);
         int limit = -1;
         Id::real_type reference_record_id{Id::unset_value};
         Database::Paging paging_order{Database::Paging::first};
         if (set)
           {
-            const XmlNode* max = set->get_child("max", RSM_NS);
+            const XmlNode* max = set->get_child("max", atoms::rsm_ns);
             if (max)
               limit = std::atoi(max->get_inner().data());
-            const XmlNode* after = set->get_child("after", RSM_NS);
+            const XmlNode* after = set->get_child("after", atoms::rsm_ns);
             if (after)
               {
                 auto after_record = Database::get_muc_log(from.bare(), iid.get_local(), iid.get_server(),
                                                           after->get_inner(), start, end);
                 reference_record_id = after_record.col<Id>();
               }
-            const XmlNode* before = set->get_child("before", RSM_NS);
+            const XmlNode* before = set->get_child("before", atoms::rsm_ns);
             if (before)
               {
                 paging_order = Database::Paging::last;
@@ -935,6 +945,24 @@ Bridge* BiboumiComponent::find_user_bridge(const std::string& full_jid)
     }
 }
 
+void BiboumiComponent::on_output_high_watermark()
+{
+  log_warning("The XMPP server is not reading our data fast enough (", this->get_output_size(),
+              " bytes waiting), stop reading from the IRC servers");
+  for (const auto& bridge: this->bridges)
+    for (const auto& irc_client: bridge.second->get_irc_clients())
+      irc_client.second->pause_recv();
+}
+
+void BiboumiComponent::on_output_low_watermark()
+{
+  log_info("The XMPP server caught up (", this->get_output_size(),
+           " bytes waiting), resume reading from the IRC servers");
+  for (const auto& bridge: this->bridges)
+    for (const auto& irc_client: bridge.second->get_irc_clients())
+      irc_client.second->resume_recv();
+}
+
 std::vector<Bridge*> BiboumiComponent::get_bridges() const
 {
   std::vector<Bridge*> res;
@@ -1079,11 +1107,11 @@ void BiboumiComponent::send_ping_request(const std::string& from,
           return;
         }
       const std::string type = stanza.get_tag("type");
-      const XmlNode* error = stanza.get_child("error", COMPONENT_NS);
+      const XmlNode* error = stanza.get_child("error", atoms::component_ns);
       // Check if what we receive is considered a valid response. And yes, those errors are valid responses
       if (type == "result" ||
-          (type == "error" && error && (error->get_child("feature-not-implemented", STANZA_NS) ||
-                                        error->get_child("service-unavailable", STANZA_NS))))
+          (type == "error" && error && (error->get_child("feature-not-implemented", atoms::stanza_ns) ||
+                                        error->get_child("service-unavailable", atoms::stanza_ns))))
         bridge->send_irc_ping_result({from, bridge}, id);
     };
   this->waiting_iq[id] = result_cb;
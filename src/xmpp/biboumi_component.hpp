@@ -119,6 +119,13 @@ public:
   Bridge* get_user_bridge(const std::string& user_jid);
 
 private:
+  /**
+   * When the XMPP server does not read our data fast enough, we stop
+   * reading from all the IRC servers, until it catches up.
+   */
+  void on_output_high_watermark() override final;
+  void on_output_low_watermark() override final;
+
   /**
    * A map of id -> callback.  When we want to wait for an iq result, we add
    * the callback to this map, with the iq id as the key. When an iq result
@@ -55,9 +55,9 @@ XmppComponent::XmppComponent(std::shared_ptr<Poller>& poller, std::string hostna
                                                   std::placeholders::_1));
   this->parser.add_stream_close_callback(std::bind(&XmppComponent::on_remote_stream_close, this,
                                                   std::placeholders::_1));
-  this->stanza_handlers.emplace("handshake",
+  this->stanza_handlers.emplace(atoms::handshake,
                                 std::bind(&XmppComponent::handle_handshake, this,std::placeholders::_1));
-  this->stanza_handlers.emplace("error",
+  this->stanza_handlers.emplace(atoms::error,
                                 std::bind(&XmppComponent::handle_error, this,std::placeholders::_1));
 }
 
@@ -73,11 +73,39 @@ bool XmppComponent::is_document_open() const
 
 void XmppComponent::send_stanza(const Stanza& stanza)
 {
-  std::string str = stanza.to_string();
+  std::string str;
+  stanza.serialize(str);
   log_debug("XMPP SENDING: ", str);
   this->send_data(std::move(str));
 }
 
+void XmppComponent::send_stanza_to_all(Stanza& stanza, const std::vector<std::string>& jids)
+{
+  if (jids.empty())
+    return;
+  if (jids.size() == 1)
+    {
+      stanza["to"] = jids.front();
+      this->send_stanza(stanza);
+      return;
+    }
+  // Its value is written separately for each JID
+  stanza["to"] = std::string{};
+  std::string before;
+  std::string after;
+  stanza.serialize_around("to", before, after);
+  const auto prefix = std::make_shared<const std::string>(std::move(before));
+  const auto suffix = std::make_shared<const std::string>(std::move(after));
+  for (const auto& jid: jids)
+    {
+      auto to = sanitize(jid);
+      log_debug("XMPP SENDING: ", *prefix, to, *suffix);
+      this->send_data(prefix);
+      this->send_data(std::move(to));
+      this->send_data(suffix);
+    }
+}
+
 void XmppComponent::on_connection_failed(const std::string& reason)
 {
   this->first_connection_try = false;
@@ -111,8 +139,8 @@ void XmppComponent::on_connection_close(const std::string& error)
 
 void XmppComponent::parse_in_buffer(const size_t size)
 {
-  // in_buf.size, or size, cannot be bigger than our read-size (4096) so it’s safe
-  // to cast.
+  // in_buf.size, or size, cannot be bigger than our read size (a few
+  // kilobytes, see the read_size option) so it’s safe to cast.
 
   if (!this->in_buf.empty())
     { // This may happen if the parser could not allocate enough space for
@@ -159,18 +187,15 @@ void XmppComponent::reset()
 
 void XmppComponent::on_stanza(const Stanza& stanza)
 {
+  const LogContext log_context(stanza.get_tag("from"));
   log_debug("XMPP RECEIVING: ", stanza.to_string());
-  std::function<void(const Stanza&)> handler;
-  try
-    {
-      handler = this->stanza_handlers.at(stanza.get_name());
-    }
-  catch (const std::out_of_range& exception)
+  const auto handler = this->stanza_handlers.find(stanza.get_name_atom());
+  if (handler == this->stanza_handlers.end())
     {
       log_warning("No handler for stanza of type ", stanza.get_name());
       return;
     }
-  handler(stanza);
+  handler->second(stanza);
 }
 
 void XmppComponent::send_stream_error(const std::string& name, const std::string& explanation)
@@ -251,7 +276,7 @@ void XmppComponent::handle_handshake(const Stanza&)
 
 void XmppComponent::handle_error(const Stanza& stanza)
 {
-  const XmlNode* text = stanza.get_child("text", STREAMS_NS);
+  const XmlNode* text = stanza.get_child("text", atoms::streams_ns);
   std::string error_message("Unspecified error");
   if (text)
     error_message = text->get_inner();
@@ -80,6 +80,12 @@ public:
    * server.
    */
   void send_stanza(const Stanza& stanza);
+  /**
+   * Send the same stanza to each of the given JIDs. It is serialized only
+   * once: the parts around its "to" attribute are shared in the out_buf,
+   * and only the value of that attribute is written for each JID.
+   */
+  void send_stanza_to_all(Stanza& stanza, const std::vector<std::string>& jids);
   /**
    * Handle the opening of the remote stream
    */
@@ -248,7 +254,10 @@ private:
 protected:
   std::string served_hostname;
 
-  std::unordered_map<std::string, std::function<void(const Stanza&)>> stanza_handlers;
+  /**
+   * The handlers of the received stanzas, by name
+   */
+  std::unordered_map<Atom, std::function<void(const Stanza&)>> stanza_handlers;
   AdhocCommandsHandler adhoc_commands_handler;
 };
 
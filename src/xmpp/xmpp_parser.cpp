@@ -3,6 +3,8 @@
 
 #include <logger/logger.hpp>
 
+constexpr std::size_t XmppParser::max_free_nodes;
+
 /**
  * Expat handlers. Called by the Expat library, never by ourself.
  * They just forward the call to the XmppParser corresponding methods.
@@ -88,7 +90,7 @@ void XmppParser::start_element(const XML_Char* name, const XML_Char** attribute)
 {
   this->level++;
 
-  auto new_node = std::make_unique<XmlNode>(name, this->current_node);
+  auto new_node = this->make_node(name);
   auto new_node_ptr = new_node.get();
   if (this->current_node)
     this->current_node->add_child(std::move(new_node));
@@ -118,12 +120,37 @@ void XmppParser::end_element(const XML_Char*)
           this->stanza_event(*this->current_node);
           // Note: deleting all the children of our parent deletes ourself,
           // so current_node is an invalid pointer after this line
-          parent->delete_all_children();
+          this->recycle_children(*parent);
         }
       this->current_node = parent;
     }
 }
 
+std::unique_ptr<XmlNode> XmppParser::make_node(const XML_Char* name)
+{
+  if (this->free_nodes.empty())
+    return std::make_unique<XmlNode>(name, this->current_node);
+  auto node = std::move(this->free_nodes.back());
+  this->free_nodes.pop_back();
+  node->reset(name, this->current_node);
+  return node;
+}
+
+void XmppParser::recycle_children(XmlNode& node)
+{
+  const auto first = this->free_nodes.size();
+  node.move_children_to(this->free_nodes);
+  // The vector grows while we walk it, so that the children of each moved
+  // node get moved as well
+  for (auto i = first; i < this->free_nodes.size(); ++i)
+    {
+      auto* moved = this->free_nodes[i].get();
+      moved->move_children_to(this->free_nodes);
+    }
+  if (this->free_nodes.size() > max_free_nodes)
+    this->free_nodes.resize(max_free_nodes);
+}
+
 void XmppParser::char_data(const XML_Char* data, const size_t len)
 {
   if (this->current_node->has_children())
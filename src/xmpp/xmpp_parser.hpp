@@ -15,7 +15,9 @@
  * After a stanza_event has been spawned, we delete the whole stanza. This
  * means that even with a very long document (in XMPP the document is
  * potentially infinite), the memory is never exhausted as long as each
- * stanza is reasonnably short.
+ * stanza is reasonnably short.  The nodes of the deleted stanza are kept
+ * (up to max_free_nodes) and reused for the next ones, so that parsing a
+ * stanza usually does not allocate anything for its nodes and their text.
  *
  * The element names generated by expat contain the namespace of the
  * element, a \1 separator and then the actual name of the element.  To get
@@ -97,11 +99,22 @@ public:
    */
   void stream_close_event(const XmlNode& node) const;
 
+  static constexpr std::size_t max_free_nodes{256};
+
 private:
   /**
    * Init the XML parser and install the callbacks
    */
   void init_xml_parser();
+  /**
+   * Return a node with that name, taken from free_nodes if possible
+   */
+  std::unique_ptr<XmlNode> make_node(const XML_Char* name);
+  /**
+   * Delete all the children of that node, and all their descendants, by
+   * moving them into free_nodes
+   */
+  void recycle_children(XmlNode& node);
 
   /**
    * Expat structure.
@@ -121,6 +134,10 @@ private:
    * is its owner.
    */
   std::unique_ptr<XmlNode> root;
+  /**
+   * The nodes of the previous stanzas, ready to be reused
+   */
+  std::vector<std::unique_ptr<XmlNode>> free_nodes;
   /**
    * A list of callbacks to be called on an *_event, receiving the
    * concerned Stanza/XmlNode.
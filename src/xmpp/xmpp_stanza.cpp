@@ -3,9 +3,9 @@
 #include <utils/encoding.hpp>
 #include <utils/split.hpp>
 
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
-#include <sstream>
 
 #include <cstring>
 
@@ -40,12 +40,129 @@ std::string xml_escape(const std::string& data)
   return res;
 }
 
+/**
+ * Append the data to out, escaped and without the chars that are not
+ * allowed in XML, in one pass and without any temporary string.
+ *
+ * Returns false, and leaves out untouched, if the data is not valid UTF-8.
+ */
+static bool append_sanitized_utf8(std::string& out, const std::string& data)
+{
+  const auto original_size = out.size();
+  // Like is_valid_utf8 and remove_invalid_xml_chars, we stop at the first
+  // \0, and rely on it to never read past the end of the string
+  const unsigned char* str = reinterpret_cast<const unsigned char*>(data.c_str());
+  const unsigned char* end = str + data.size();
+  // The beginning of the chars that we keep as is, but have not appended yet
+  const unsigned char* run = str;
+  const auto flush = [&out, &run](const unsigned char* current)
+  {
+    out.append(reinterpret_cast<const char*>(run), static_cast<std::size_t>(current - run));
+  };
+
+  while (true)
+    {
+      // Skip the chars that need no work at all (usually the whole string)
+      str += utils::xml_safe_prefix_size(reinterpret_cast<const char*>(str),
+                                         static_cast<std::size_t>(end - str));
+      const unsigned char c = str[0];
+      if (!c)
+        break;
+      if ((c & 0b10000000) == 0)
+        {
+          const char* escaped = nullptr;
+          switch (c)
+            {
+            case '&':
+              escaped = "&amp;";
+              break;
+            case '<':
+              escaped = "&lt;";
+              break;
+            case '>':
+              escaped = "&gt;";
+              break;
+            case '\"':
+              escaped = "&quot;";
+              break;
+            case '\'':
+              escaped = "&apos;";
+              break;
+            default:
+              if (c >= 0x20 || c == 0x09 || c == 0x0A || c == 0x0D)
+                {
+                  ++str;
+                  continue;
+                }
+              break;
+            }
+          flush(str);
+          if (escaped)
+            out += escaped;
+          run = ++str;
+        }
+      else if ((c & 0b11111000) == 0b11110000)
+        {
+          if (!str[1] || !str[2] || !str[3]
+              || ((str[1] & 0b11000000u) != 0b10000000u)
+              || ((str[2] & 0b11000000u) != 0b10000000u)
+              || ((str[3] & 0b11000000u) != 0b10000000u))
+            break;
+          const auto codepoint = ((c & 0b00000111u) << 18u) | ((str[1] & 0b00111111u) << 12u) |
+              ((str[2] & 0b00111111u) << 6u) | (str[3] & 0b00111111u);
+          if (codepoint > 0x10FFFF)
+            {
+              flush(str);
+              run = str + 4;
+            }
+          str += 4;
+        }
+      else if ((c & 0b11110000) == 0b11100000)
+        {
+          if (!str[1] || !str[2]
+              || ((str[1] & 0b11000000u) != 0b10000000u)
+              || ((str[2] & 0b11000000u) != 0b10000000u))
+            break;
+          const auto codepoint = ((c & 0b00001111u) << 12u) | ((str[1] & 0b00111111u) << 6u) |
+              (str[2] & 0b00111111u);
+          if (codepoint > 0xD7FF && (codepoint < 0xE000 || codepoint > 0xFFFD))
+            {
+              flush(str);
+              run = str + 3;
+            }
+          str += 3;
+        }
+      else if ((c & 0b11100000) == 0b11000000)
+        {
+          if (!str[1] || ((str[1] & 0b11000000u) != 0b10000000u))
+            break;
+          str += 2;
+        }
+      else
+        break;
+    }
+  if (*str)
+    {
+      // Invalid UTF-8
+      out.resize(original_size);
+      return false;
+    }
+  flush(str);
+  return true;
+}
+
+static void append_sanitized(std::string& out, const std::string& data,
+                             const std::string& encoding = "ISO-8859-1")
+{
+  if (!append_sanitized_utf8(out, data))
+    append_sanitized_utf8(out, utils::convert_to_utf8(data, encoding.data()));
+}
+
 std::string sanitize(const std::string& data, const std::string& encoding)
 {
-  if (utils::is_valid_utf8(data.data()))
-    return xml_escape(utils::remove_invalid_xml_chars(data));
-  else
-    return xml_escape(utils::remove_invalid_xml_chars(utils::convert_to_utf8(data, encoding.data())));
+  std::string res;
+  append_sanitized(res, data, encoding);
+  return res;
 }
 
 XmlNode::XmlNode(const std::string& name, XmlNode* parent):
@@ -58,7 +175,7 @@ XmlNode::XmlNode(const std::string& name, XmlNode* parent):
   else
     {
       this->name = name.substr(n+1);
-      this->attributes["xmlns"] = name.substr(0, n);
+      (*this)["xmlns"] = name.substr(0, n);
     }
 }
 
@@ -71,7 +188,7 @@ XmlNode::XmlNode(const std::string& xmlns, const std::string& name, XmlNode* par
     name(name),
     parent(parent)
 {
-  this->attributes["xmlns"] = xmlns;
+  (*this)["xmlns"] = xmlns;
 }
 
 XmlNode::XmlNode(const std::string& xmlns, const std::string& name):
@@ -84,9 +201,49 @@ void XmlNode::delete_all_children()
   this->children.clear();
 }
 
+void XmlNode::move_children_to(std::vector<std::unique_ptr<XmlNode>>& nodes)
+{
+  for (auto& child: this->children)
+    {
+      child->parent = nullptr;
+      nodes.push_back(std::move(child));
+    }
+  this->children.clear();
+}
+
+void XmlNode::reset(const char* name, XmlNode* parent)
+{
+  // Past that size, we’d rather not keep the memory around
+  constexpr std::size_t max_capacity = 4096;
+
+  this->parent = parent;
+  this->attributes.clear();
+  this->children.clear();
+  for (auto* data: {&this->inner, &this->tail})
+    {
+      if (data->capacity() > max_capacity)
+        std::string{}.swap(*data);
+      else
+        data->clear();
+    }
+  // split the namespace and the name
+  const char* n = std::strrchr(name, '\1');
+  if (!n)
+    this->name.assign(name);
+  else
+    {
+      this->name.assign(n + 1);
+      (*this)["xmlns"].assign(name, static_cast<std::size_t>(n - name));
+    }
+  // This is how the parser creates its nodes: they will almost certainly
+  // be looked for, so we find their atoms right away
+  this->name_atom = atoms::find(this->name);
+  this->xmlns_atom = atoms::find(this->get_tag("xmlns"));
+}
+
 void XmlNode::set_attribute(const std::string& name, const std::string& value)
 {
-  this->attributes[name] = value;
+  (*this)[name] = value;
 }
 
 void XmlNode::set_tail(const std::string& data)
@@ -140,6 +297,27 @@ std::vector<const XmlNode*> XmlNode::get_children(const std::string& name, const
   return res;
 }
 
+const XmlNode* XmlNode::get_child(const std::string& name, const Atom xmlns) const
+{
+  for (const auto& child: this->children)
+    {
+      if (child->get_xmlns_atom() == xmlns && child->name == name)
+        return child.get();
+    }
+  return nullptr;
+}
+
+std::vector<const XmlNode*> XmlNode::get_children(const std::string& name, const Atom xmlns) const
+{
+  std::vector<const XmlNode*> res;
+  for (const auto& child: this->children)
+    {
+      if (child->get_xmlns_atom() == xmlns && child->name == name)
+        res.push_back(child.get());
+    }
+  return res;
+}
+
 XmlNode* XmlNode::add_child(std::unique_ptr<XmlNode> child)
 {
   child->parent = this;
@@ -173,11 +351,13 @@ XmlNode* XmlNode::get_parent() const
 void XmlNode::set_name(const std::string& name)
 {
   this->name = name;
+  this->name_atom = no_atom;
 }
 
 void XmlNode::set_name(std::string&& name)
 {
   this->name = std::move(name);
+  this->name_atom = no_atom;
 }
 
 const std::string XmlNode::get_name() const
@@ -185,23 +365,76 @@ const std::string XmlNode::get_name() const
   return this->name;
 }
 
+Atom XmlNode::get_name_atom() const
+{
+  if (this->name_atom == no_atom)
+    this->name_atom = atoms::find(this->name);
+  return this->name_atom;
+}
+
+Atom XmlNode::get_xmlns_atom() const
+{
+  if (this->xmlns_atom == no_atom)
+    this->xmlns_atom = atoms::find(this->get_tag("xmlns"));
+  return this->xmlns_atom;
+}
+
 std::string XmlNode::to_string() const
 {
-  std::ostringstream res;
-  res << "<" << this->name;
+  std::string res;
+  this->serialize(res);
+  return res;
+}
+
+void XmlNode::serialize(std::string& out) const
+{
+  out += '<';
+  out += this->name;
   for (const auto& it: this->attributes)
-    res << " " << it.first << "='" << sanitize(it.second) + "'";
+    {
+      out += ' ';
+      out += it.first;
+      out += "='";
+      append_sanitized(out, it.second);
+      out += '\'';
+    }
+  this->serialize_content(out);
+}
+
+void XmlNode::serialize_around(const std::string& attribute, std::string& before, std::string& after) const
+{
+  std::string* out = &before;
+  before += '<';
+  before += this->name;
+  for (const auto& it: this->attributes)
+    {
+      *out += ' ';
+      *out += it.first;
+      *out += "='";
+      if (it.first == attribute)
+        out = &after;
+      else
+        append_sanitized(*out, it.second);
+      *out += '\'';
+    }
+  this->serialize_content(*out);
+}
+
+void XmlNode::serialize_content(std::string& out) const
+{
   if (!this->has_children() && this->inner.empty())
-    res << "/>";
+    out += "/>";
   else
     {
-      res << ">" + sanitize(this->inner);
+      out += '>';
+      append_sanitized(out, this->inner);
       for (const auto& child: this->children)
-        res << child->to_string();
-      res << "</" << this->get_name() << ">";
+        child->serialize(out);
+      out += "</";
+      out += this->name;
+      out += '>';
     }
-  res << sanitize(this->tail);
-  return res.str();
+  append_sanitized(out, this->tail);
 }
 
 bool XmlNode::has_children() const
@@ -211,30 +444,52 @@ bool XmlNode::has_children() const
 
 const std::string& XmlNode::get_tag(const std::string& name) const
 {
-  try
-    {
-      const auto& value = this->attributes.at(name);
-      return value;
-    }
-  catch (const std::out_of_range& e)
-    {
-      static const std::string def{};
-      return def;
-    }
+  const auto it = this->find_attribute(name);
+  if (it != this->attributes.end() && it->first == name)
+    return it->second;
+  static const std::string def{};
+  return def;
 }
 
 bool XmlNode::del_tag(const std::string& name)
 {
-  if (this->attributes.erase(name) != 0)
-    return true;
-  return false;
+  const auto it = this->find_attribute(name);
+  if (it == this->attributes.end() || it->first != name)
+    return false;
+  if (name == "xmlns")
+    this->xmlns_atom = no_atom;
+  this->attributes.erase(it);
+  return true;
 }
 
 std::string& XmlNode::operator[](const std::string& name)
 {
-  return this->attributes[name];
+  // We can’t know what will be done with the returned value
+  if (name == "xmlns")
+    this->xmlns_atom = no_atom;
+  auto it = this->find_attribute(name);
+  if (it == this->attributes.end() || it->first != name)
+    it = this->attributes.emplace(it, name, std::string{});
+  return it->second;
 }
 
+XmlNode::Attributes::const_iterator XmlNode::find_attribute(const std::string& name) const
+{
+  return std::lower_bound(this->attributes.begin(), this->attributes.end(), name,
+                          [](const Attributes::value_type& attribute, const std::string& name)
+                          {
+                            return attribute.first < name;
+                          });
+}
+
+XmlNode::Attributes::iterator XmlNode::find_attribute(const std::string& name)
+{
+  const auto it = static_cast<const XmlNode*>(this)->find_attribute(name);
+  return this->attributes.begin() + (it - this->attributes.cbegin());
+}
+
+constexpr Atom XmlNode::no_atom;
+
 std::ostream& operator<<(std::ostream& os, const XmlNode& node)
 {
   return os << node.to_string();
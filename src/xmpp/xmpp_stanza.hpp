@@ -1,7 +1,7 @@
 #pragma once
 
+#include <xmpp/atoms.hpp>
 
-#include <map>
 #include <string>
 #include <vector>
 #include <memory>
@@ -16,7 +16,7 @@ std::string sanitize(const std::string& data, const std::string& encoding = "ISO
      nullptr)
  * - zero, one or more children XML nodes
  * - A name
- * - A map of attributes
+ * - A list of attributes, sorted by name
  * - inner data (text inside the node)
  * - tail data (text just after the node)
  */
@@ -37,7 +37,9 @@ public:
     attributes(node.attributes),
     children{},
     inner(node.inner),
-    tail(node.tail)
+    tail(node.tail),
+    name_atom(node.name_atom),
+    xmlns_atom(node.xmlns_atom)
   {
     for (const auto& child: node.children)
       this->add_child(std::make_unique<XmlNode>(*child));
@@ -50,6 +52,17 @@ public:
   ~XmlNode() = default;
 
   void delete_all_children();
+  /**
+   * Move all the children at the end of the given vector, and forget about
+   * them
+   */
+  void move_children_to(std::vector<std::unique_ptr<XmlNode>>& nodes);
+  /**
+   * Make this node as if it was just constructed with that name and parent,
+   * but keep the memory already allocated for its strings, so that it can
+   * be reused without any allocation. Its children are deleted.
+   */
+  void reset(const char* name, XmlNode* parent);
   void set_attribute(const std::string& name, const std::string& value);
   /**
    * Set the content of the tail, that is the text just after this node
@@ -86,6 +99,12 @@ public:
    * Get a vector of all the children that have that name and that xml namespace.
    */
   std::vector<const XmlNode*> get_children(const std::string& name, const std::string& xmlns) const;
+  /**
+   * Same thing, but the namespace is given as an atom, so that only
+   * integers are compared when looking for it
+   */
+  const XmlNode* get_child(const std::string& name, const Atom xmlns) const;
+  std::vector<const XmlNode*> get_children(const std::string& name, const Atom xmlns) const;
   /**
    * Add a node child to this node. Assign this node to the child’s parent.
    * Returns a pointer to the newly added child.
@@ -103,10 +122,29 @@ public:
   void set_name(const std::string& name);
   void set_name(std::string&& name);
   const std::string get_name() const;
+  /**
+   * The atoms of the name and the namespace of this node (atoms::none if
+   * they are unknown)
+   */
+  Atom get_name_atom() const;
+  Atom get_xmlns_atom() const;
   /**
    * Serialize the stanza into a string
    */
   std::string to_string() const;
+  /**
+   * Serialize the stanza at the end of the given string. Everything is
+   * escaped while being appended, no temporary string is created.
+   */
+  void serialize(std::string& out) const;
+  /**
+   * Serialize the stanza in two parts, at the end of before and after,
+   * leaving out the value of the given attribute: writing any (escaped)
+   * value between the two parts gives the same result as setting that
+   * value and calling serialize().  If the node does not have that
+   * attribute, everything is written in before.
+   */
+  void serialize_around(const std::string& attribute, std::string& before, std::string& after) const;
   /**
    * Whether or not this node has at least one child (if not, this is a leaf
    * node)
@@ -128,12 +166,36 @@ public:
   std::string& operator[](const std::string& name);
 
 private:
+  /**
+   * A stanza has only a few attributes: a sorted vector is much cheaper
+   * than a map, to build, to copy and to search.
+   */
+  using Attributes = std::vector<std::pair<std::string, std::string>>;
+  /**
+   * Return the attribute with that name, or the position where it should
+   * be inserted
+   */
+  Attributes::const_iterator find_attribute(const std::string& name) const;
+  Attributes::iterator find_attribute(const std::string& name);
+  /**
+   * Serialize what follows the attributes: the end of the opening tag,
+   * the content, the closing tag and the tail
+   */
+  void serialize_content(std::string& out) const;
+
   std::string name;
   XmlNode* parent;
-  std::map<std::string, std::string> attributes;
+  Attributes attributes;
   std::vector<std::unique_ptr<XmlNode>> children;
   std::string inner;
   std::string tail;
+  /**
+   * Computed when needed, and forgotten when the name or the namespace
+   * change (no_atom)
+   */
+  static constexpr Atom no_atom{static_cast<Atom>(-1)};
+  mutable Atom name_atom{no_atom};
+  mutable Atom xmlns_atom{no_atom};
 };
 
 std::ostream& operator<<(std::ostream& os, const XmlNode& node);
@@ -1,7 +1,10 @@
 #include "catch.hpp"
 
 #include <utils/encoding.hpp>
+#include <xmpp/xmpp_stanza.hpp>
 
+#include <chrono>
+#include <vector>
 
 TEST_CASE("UTF-8 validation")
 {
@@ -52,3 +55,75 @@ TEST_CASE("Remove invalid XML chars")
   CHECK(utils::remove_invalid_xml_chars(in) == in);
   CHECK(utils::remove_invalid_xml_chars("\acouco\u0008u\uFFFEt\uFFFFe\r\n♥") == "coucoute\r\n♥");
 }
+
+TEST_CASE("XML safe prefix")
+{
+  CHECK(utils::xml_safe_prefix_size("", 0) == 0);
+  CHECK(utils::xml_safe_prefix_size("coucou", 6) == 6);
+  CHECK(utils::xml_safe_prefix_size("coucou", 3) == 3);
+  const std::string long_text = "This is a sentence longer than sixteen chars, without anything to escape~";
+  CHECK(utils::xml_safe_prefix_size(long_text.data(), long_text.size()) == long_text.size());
+  for (const auto& unsafe: std::vector<std::string>{"&", "<", ">", "\"", "'", "\t", "\n", "\x01", "\xC3\xA9", std::string(1, '\0')})
+    for (std::size_t pos = 0; pos < 40; ++pos)
+      {
+        const auto text = std::string(pos, 'a') + unsafe + std::string(40, 'b');
+        CHECK(utils::xml_safe_prefix_size(text.data(), text.size()) == pos);
+      }
+}
+
+/**
+ * Lines looking like what we receive from IRC: mostly ASCII, some with
+ * chars to escape, some UTF-8, some latin-1 and some colors.
+ */
+static std::vector<std::string> irc_lines()
+{
+  const std::vector<std::string> lines = {
+    "ok",
+    "lol",
+    "Did anyone manage to build it with the latest version of the compiler? I get a weird error",
+    "I pushed the fix, can you try again?",
+    "see https://example.com/issues?id=1234&sort=desc for the details",
+    "if (a < b && b > c) return \"nope\";",
+    "it's working now, thanks!",
+    "Bonjour à tous, est-ce que quelqu’un a déjà essayé ça ?",
+    "\x02" "bold\x02 and \x03" "04red\x03 text, for the \x1F" "bots\x1F",
+    "\xE9t\xE9 " "comme hiver, en latin-1",
+    "こんにちは、元気ですか？",
+    "\xF0\x9F\x98\x80\xF0\x9F\x98\x80 ^^",
+  };
+  std::vector<std::string> res;
+  for (int i = 0; i < 1000; ++i)
+    for (const auto& line: lines)
+      res.push_back(line + " " + std::to_string(i));
+  return res;
+}
+
+TEST_CASE("Sanitize benchmark", "[.benchmark]")
+{
+  const auto lines = irc_lines();
+  const auto measure = [](auto&& function) {
+    const auto begin = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+  };
+  std::size_t size = 0;
+  const auto old_duration = measure([&]() {
+      for (int i = 0; i < 10; ++i)
+        for (const auto& line: lines)
+          {
+            if (utils::is_valid_utf8(line.data()))
+              size += xml_escape(utils::remove_invalid_xml_chars(line)).size();
+            else
+              size += xml_escape(utils::remove_invalid_xml_chars(utils::convert_to_utf8(line, "ISO-8859-1"))).size();
+          }
+    });
+  const auto new_duration = measure([&]() {
+      for (int i = 0; i < 10; ++i)
+        for (const auto& line: lines)
+          size -= sanitize(line).size();
+    });
+  CHECK(size == 0);
+
+  WARN(lines.size() * 10 << " lines, is_valid_utf8, remove_invalid_xml_chars and xml_escape: " << old_duration.count() << "ms");
+  WARN(lines.size() * 10 << " lines, sanitize: " << new_duration.count() << "ms");
+}
@@ -0,0 +1,6 @@
+from scenarios import *
+
+scenario = (
+    send_stanza("<iq type='set' id='command1' from='{jid_admin}/{resource_one}' to='{biboumi_host}'><command xmlns='http://jabber.org/protocol/commands' node='get-dns-cache-info' action='execute' /></iq>"),
+    expect_stanza("/iq[@type='result']/commands:command[@node='get-dns-cache-info'][@status='completed']/commands:note[@type='info'][contains(text(), 'hostnames in the DNS cache')]"),
+)
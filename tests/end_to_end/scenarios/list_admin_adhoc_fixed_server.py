@@ -7,6 +7,6 @@ scenario = (
     expect_stanza("/iq[@type='result']/disco_items:query[@node='http://jabber.org/protocol/commands']",
                   "/iq/disco_items:query/disco_items:item[@node='global-configure']",
                   "/iq/disco_items:query/disco_items:item[@node='server-configure']",
-                  "/iq/disco_items:query/disco_items:item[8]",
-                  "!/iq/disco_items:query/disco_items:item[9]"),
+                  "/iq/disco_items:query/disco_items:item[9]",
+                  "!/iq/disco_items:query/disco_items:item[10]"),
 )
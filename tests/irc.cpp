@@ -1,6 +1,21 @@
 #include "catch.hpp"
 
+#include <biboumi.h>
+
 #include <irc/irc_message.hpp>
+#include <irc/irc_client.hpp>
+#include <irc/connection_scheduler.hpp>
+#include <bridge/bridge.hpp>
+#include <xmpp/biboumi_component.hpp>
+#include <network/poller.hpp>
+#ifdef USE_DATABASE
+# include <database/database.hpp>
+#endif
+#include <utils/timed_events.hpp>
+#include <config/config.hpp>
+
+#include <vector>
+#include <thread>
 
 TEST_CASE("Basic IRC message parsing")
 {
@@ -41,3 +56,103 @@ TEST_CASE("Message with empty :")
   CHECK(m.arguments[1] == "deux");
   CHECK(m.arguments[2] == "");
 }
+
+TEST_CASE("ConnectionScheduler")
+{
+  auto& scheduler = ConnectionScheduler::instance();
+  std::vector<int> started;
+  const int ids[4] = {};
+  const auto start = [&started](const int i)
+  {
+    return [&started, i]() { started.push_back(i); };
+  };
+
+  SECTION("Concurrency limit and priority")
+    {
+      Config::set("irc_server_max_connecting", "2");
+      Config::set("irc_server_connection_interval", "0");
+      scheduler.schedule("a.example", &ids[0], false, start(0));
+      scheduler.schedule("a.example", &ids[1], false, start(1));
+      scheduler.schedule("a.example", &ids[2], false, start(2));
+      scheduler.schedule("a.example", &ids[3], true, start(3));
+      CHECK(started == std::vector<int>{0, 1});
+      CHECK(scheduler.in_progress("a.example") == 2);
+      CHECK(scheduler.queue_size("a.example") == 2);
+      CHECK(scheduler.is_queued("a.example", &ids[2]));
+      // Other servers are not affected
+      CHECK(scheduler.queue_size("b.example") == 0);
+
+      scheduler.finished("a.example", &ids[0]);
+      CHECK(started == std::vector<int>{0, 1, 3});
+      // Not in progress anymore, but still queued: just removed
+      scheduler.finished("a.example", &ids[2]);
+      CHECK(scheduler.queue_size() == 0);
+      scheduler.finished("a.example", &ids[1]);
+      scheduler.finished("a.example", &ids[3]);
+      CHECK(started == std::vector<int>{0, 1, 3});
+      CHECK(scheduler.in_progress("a.example") == 0);
+      CHECK(scheduler.servers_count() == 0);
+    }
+  SECTION("Rate limit")
+    {
+      Config::set("irc_server_max_connecting", "0");
+      Config::set("irc_server_connection_interval", "20");
+      scheduler.schedule("c.example", &ids[0], false, start(0));
+      scheduler.schedule("c.example", &ids[1], false, start(1));
+      CHECK(started == std::vector<int>{0});
+      CHECK(TimedEventsManager::instance().find_event("ConnectionSchedulerc.example"));
+      for (int i = 0; i < 100 && started.size() < 2; ++i)
+        {
+          std::this_thread::sleep_for(5ms);
+          TimedEventsManager::instance().execute_expired_events();
+        }
+      CHECK(started == std::vector<int>{0, 1});
+      scheduler.finished("c.example", &ids[0]);
+      scheduler.finished("c.example", &ids[1]);
+      // Still known, until the interval after the last start is over
+      CHECK(scheduler.servers_count() == 1);
+      for (int i = 0; i < 100 && scheduler.servers_count() > 0; ++i)
+        {
+          std::this_thread::sleep_for(5ms);
+          TimedEventsManager::instance().execute_expired_events();
+        }
+      CHECK(scheduler.servers_count() == 0);
+    }
+  Config::clear();
+}
+
+TEST_CASE("ConnectionScheduler priority of the online users")
+{
+#ifdef USE_DATABASE
+  Database::open(":memory:");
+#endif
+  Config::set("irc_server_max_connecting", "1");
+  Config::set("irc_server_connection_interval", "0");
+  auto& scheduler = ConnectionScheduler::instance();
+  // Keep the only slot busy, so that nothing else is started
+  const int busy = 0;
+  scheduler.schedule("irc.localhost", &busy, false, []() {});
+  {
+    auto poller = std::make_shared<Poller>();
+    BiboumiComponent xmpp(poller, "biboumi.localhost", "secret");
+    Bridge online("online@localhost", xmpp, poller);
+    Bridge offline("offline@localhost", xmpp, poller);
+    online.resources_in_server["irc.localhost"] = {"a"};
+    IrcClient online_irc(poller, "irc.localhost", "online", "online", "online", "localhost", online);
+    IrcClient offline_irc(poller, "irc.localhost", "offline", "offline", "offline", "localhost", offline);
+
+    // The offline user reconnects first, but it waits for the online one
+    offline_irc.start();
+    online_irc.start();
+    CHECK(offline_irc.is_connection_scheduled());
+    CHECK(online_irc.is_connection_scheduled());
+    CHECK(scheduler.queued("irc.localhost") == std::vector<const void*>{&online_irc, &offline_irc});
+  }
+  CHECK(scheduler.queue_size("irc.localhost") == 0);
+  scheduler.finished("irc.localhost", &busy);
+  CHECK(scheduler.servers_count() == 0);
+  Config::clear();
+#ifdef USE_DATABASE
+  Database::close();
+#endif
+}
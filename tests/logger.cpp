@@ -8,6 +8,30 @@
 
 using namespace std::string_literals;
 
+namespace
+{
+  /**
+   * Redirects std::cout until the object is destroyed. The logger created
+   * in the meantime writes into that redirection, so it is destroyed
+   * first.
+   */
+  class LogTester: public IoTester<std::ostream>
+  {
+  public:
+    LogTester():
+      IoTester<std::ostream>(std::cout)
+    {}
+    ~LogTester()
+    {
+      Logger::instance().reset();
+    }
+    LogTester& operator=(const LogTester&) = delete;
+    LogTester& operator=(LogTester&&) = delete;
+    LogTester(const LogTester&) = delete;
+    LogTester(LogTester&&) = delete;
+  };
+}
+
 TEST_CASE("Basic logging")
 {
   const std::string debug_header = "[DEBUG]: ";
@@ -18,14 +42,14 @@ TEST_CASE("Basic logging")
       Config::set("log_level", "0");
       WHEN("we log some debug text")
         {
-          IoTester<std::ostream> out(std::cout);
+          LogTester out;
           log_debug("deb", "ug");
           THEN("debug logs are written")
             CHECK(out.str() == debug_header + "tests/logger.cpp:" + std::to_string(__LINE__ - 2) + ":\tdebug\n");
         }
       WHEN("we log some errors")
         {
-          IoTester<std::ostream> out(std::cout);
+          LogTester out;
           log_error("err", 12, "or");
           THEN("error logs are written")
             CHECK(out.str() == error_header + "tests/logger.cpp:" + std::to_string(__LINE__ - 2) + ":\terr12or\n");
@@ -36,17 +60,114 @@ TEST_CASE("Basic logging")
       Config::set("log_level", "3");
       WHEN("we log some debug text")
         {
-          IoTester<std::ostream> out(std::cout);
+          LogTester out;
           log_debug(123, "debug");
           THEN("nothing is written")
             CHECK(out.str().empty());
         }
       WHEN("we log some errors")
         {
-          IoTester<std::ostream> out(std::cout);
+          LogTester out;
           log_error(123, " errors");
           THEN("error logs are still written")
             CHECK(out.str() == error_header + "tests/logger.cpp:" + std::to_string(__LINE__ - 2) + ":\t123 errors\n");
         }
+      WHEN("we log some debug text with a costly argument")
+        {
+          LogTester out;
+          int evaluated = 0;
+          const auto argument = [&evaluated]() { evaluated++; return "debug"; };
+          log_debug(argument());
+          THEN("the argument is not even evaluated")
+            CHECK(evaluated == 0);
+        }
+    }
+  GIVEN("An asynchronous logger")
+    {
+      Config::set("log_level", "0");
+      Config::set("log_async", "true");
+      WHEN("we log some text")
+        {
+          LogTester out;
+          log_debug("deb", "ug");
+          log_error("err", 12, "or");
+          const auto line = __LINE__;
+          CHECK(Logger::instance()->is_async());
+          // Wait for the writer thread to write everything
+          Logger::instance().reset();
+          THEN("the logs are written")
+            CHECK(out.str() == debug_header + "tests/logger.cpp:" + std::to_string(line - 2) + ":\tdebug\n" +
+                  error_header + "tests/logger.cpp:" + std::to_string(line - 1) + ":\terr12or\n");
+        }
+      WHEN("we log faster than the writer thread can write")
+        {
+          Config::set("log_async_queue_size", "4");
+          LogTester out;
+          constexpr std::size_t count = 10000;
+          for (std::size_t i = 0; i < count; ++i)
+            log_debug("message ", i);
+          const auto dropped = Logger::instance()->get_dropped();
+          Logger::instance().reset();
+          THEN("some messages are dropped, and counted")
+            {
+              const auto output = out.str();
+              std::size_t written = 0;
+              for (auto pos = output.find(":\tmessage "); pos != std::string::npos; pos = output.find(":\tmessage ", pos + 1))
+                written++;
+              CHECK(written == count - dropped);
+              if (dropped > 0)
+                CHECK(output.find("log messages were dropped") != std::string::npos);
+            }
+          Config::set("log_async_queue_size", "65536");
+        }
+      Config::set("log_async", "false");
+      Config::set("log_level", "3");
+    }
+  Logger::instance().reset();
+}
+
+TEST_CASE("Log filters")
+{
+  using namespace logging_details;
+  static_assert(get_subsystem("src/irc/irc_client.cpp") == irc_subsystem, "");
+  static_assert(get_subsystem("src/network/poller.cpp") == network_subsystem, "");
+  static_assert(get_subsystem("src/main.cpp") == other_subsystem, "");
+  static_assert(get_subsystem("tests/logger.cpp") == other_subsystem, "");
+
+  Config::set("log_level", "2");
+  Config::set("log_level_irc", "0");
+  Config::set("log_filter_hostnames", "irc.example.com:1 debug.example.com");
+  Config::set("log_filter_jids", "User@example.com:0");
+  Logger::instance().reset();
+  const auto& logger = *Logger::instance();
+
+  CHECK_FALSE(logger.is_enabled(info_lvl, network_subsystem));
+  CHECK(logger.is_enabled(warning_lvl, network_subsystem));
+  CHECK(logger.is_enabled(debug_lvl, irc_subsystem));
+  {
+    const LogContext context("someone@example.com/resource", "IRC.example.com");
+    CHECK(logger.is_enabled(info_lvl, network_subsystem));
+    // The level of the context is used, even if the subsystem has a lower one
+    CHECK_FALSE(logger.is_enabled(debug_lvl, irc_subsystem));
+    {
+      const LogContext inner("user@example.com/resource");
+      CHECK(logger.is_enabled(debug_lvl, network_subsystem));
     }
+    CHECK_FALSE(logger.is_enabled(debug_lvl, network_subsystem));
+  }
+  CHECK_FALSE(logger.is_enabled(info_lvl, network_subsystem));
+  {
+    const LogContext context("nobody@example.com", "debug.example.com");
+    CHECK(logger.is_enabled(debug_lvl, xmpp_subsystem));
+  }
+  {
+    const LogContext context("nobody@example.com", "other.example.com");
+    CHECK_FALSE(logger.is_enabled(info_lvl, xmpp_subsystem));
+  }
+
+  Config::set("log_level", "3");
+  Config::set("log_level_irc", "");
+  Config::set("log_filter_hostnames", "");
+  Config::set("log_filter_jids", "");
+  Logger::instance().reset();
 }
@@ -1,6 +1,680 @@
 #include "catch.hpp"
 #include <network/tls_policy.hpp>
+#include <network/poller.hpp>
+#include <network/output_buffer.hpp>
+#include <network/receive_buffer.hpp>
+#include <network/tcp_socket_handler.hpp>
+#include <network/tcp_client_socket_handler.hpp>
+#include <network/dns_cache.hpp>
+#include <network/timer_socket_handler.hpp>
+#include <utils/timed_events.hpp>
 #include <sstream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std::chrono_literals;
+using namespace std::string_literals;
+
+namespace
+{
+  /**
+   * Counts the events reported by the poller on one end of a socketpair
+   */
+  class CountingSocketHandler: public SocketHandler
+  {
+  public:
+    CountingSocketHandler(std::shared_ptr<Poller>& poller, const socket_t socket):
+      SocketHandler(poller, socket)
+    {}
+    ~CountingSocketHandler()
+    {
+      ::close(this->socket);
+    }
+    void on_recv() override
+    {
+      char buf[64];
+      ::recv(this->socket, buf, sizeof(buf), 0);
+      this->recv_count++;
+    }
+    void on_send() override
+    {
+      this->send_count++;
+    }
+    bool is_connected() const override
+    {
+      return true;
+    }
+    int recv_count{0};
+    int send_count{0};
+  };
+}
+
+TEST_CASE("Poller")
+{
+  auto poller = std::make_shared<Poller>();
+  std::vector<std::unique_ptr<CountingSocketHandler>> handlers;
+  std::vector<socket_t> peers;
+  for (int i = 0; i < 8; ++i)
+    {
+      int sv[2];
+      REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+      handlers.push_back(std::make_unique<CountingSocketHandler>(poller, sv[0]));
+      poller->add_socket_handler(handlers.back().get());
+      peers.push_back(sv[1]);
+    }
+  CHECK(poller->size() == 8);
+
+  // Remove a socket in the middle, the other ones are still watched
+  poller->remove_socket_handler(handlers[2]->get_socket());
+  CHECK(poller->size() == 7);
+  CHECK_FALSE(poller->is_managing_socket(handlers[2]->get_socket()));
+  CHECK(poller->is_managing_socket(handlers[7]->get_socket()));
+
+  ::send(peers[7], "a", 1, 0);
+  ::send(peers[2], "a", 1, 0);
+  CHECK(poller->poll(100ms) >= 1);
+  CHECK(handlers[7]->recv_count == 1);
+  CHECK(handlers[2]->recv_count == 0);
+
+  // In edge-triggered mode, the sockets may have been reported as writable
+  // once already
+  const auto send_count = handlers[5]->send_count;
+  poller->watch_send_events(handlers[5].get());
+  poller->poll(100ms);
+  CHECK(handlers[5]->send_count == send_count + 1);
+  poller->stop_watching_send_events(handlers[5].get());
+  CHECK(poller->poll(10ms) == 0);
+  CHECK(handlers[5]->send_count == send_count + 1);
+
+  for (const auto& handler: handlers)
+    if (poller->is_managing_socket(handler->get_socket()))
+      poller->remove_socket_handler(handler->get_socket());
+  for (const auto peer: peers)
+    ::close(peer);
+}
+
+namespace
+{
+  class WatermarkSocketHandler: public TCPSocketHandler
+  {
+  public:
+    WatermarkSocketHandler(std::shared_ptr<Poller>& poller, const socket_t socket):
+      TCPSocketHandler(poller)
+    {
+      this->socket = socket;
+    }
+    ~WatermarkSocketHandler() = default;
+    void parse_in_buffer(const std::size_t) override
+    {
+      this->received += this->in_buf.size();
+      this->in_buf.clear();
+    }
+    bool is_connected() const override
+    { return true; }
+    bool is_connecting() const override
+    { return false; }
+    void on_output_high_watermark() override
+    { this->high_count++; }
+    void on_output_low_watermark() override
+    { this->low_count++; }
+    void on_connection_close(const std::string&) override
+    { this->close_count++; }
+    using TCPSocketHandler::add_to_poller;
+    int high_count{0};
+    int low_count{0};
+    int close_count{0};
+    std::size_t received{0};
+  };
+
+  class ClientSocketHandler: public TCPClientSocketHandler
+  {
+  public:
+    ClientSocketHandler(std::shared_ptr<Poller>& poller):
+      TCPClientSocketHandler(poller)
+    {}
+    void parse_in_buffer(const std::size_t) override
+    {
+      this->in_buf.clear();
+    }
+    void on_connected() override
+    { this->connected_count++; }
+    void on_connection_failed(const std::string& reason) override
+    { this->failure = reason; }
+    int connected_count{0};
+    std::string failure;
+  };
+}
+
+TEST_CASE("TCPSocketHandler watermarks")
+{
+  auto poller = std::make_shared<Poller>();
+  int sv[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  WatermarkSocketHandler handler(poller, sv[0]);
+  handler.add_to_poller();
+  handler.set_output_watermarks(1000, 100);
+
+  handler.send_data(std::string(600, 'a'));
+  CHECK(handler.get_output_size() == 600);
+  CHECK(handler.high_count == 0);
+  handler.send_data(std::string(600, 'b'));
+  CHECK(handler.get_output_size() == 1200);
+  CHECK(handler.high_count == 1);
+  CHECK(handler.is_above_output_high_watermark());
+  handler.send_data(std::string(600, 'c'));
+  CHECK(handler.high_count == 1);
+
+  for (int i = 0; i < 10 && handler.get_output_size() > 0; ++i)
+    poller->poll(100ms);
+  CHECK(handler.get_output_size() == 0);
+  CHECK(handler.low_count == 1);
+  CHECK_FALSE(handler.is_above_output_high_watermark());
+
+  // Nothing is read while receiving is paused
+  handler.pause_recv();
+  ::send(sv[1], "a", 1, 0);
+  poller->poll(10ms);
+  CHECK(handler.received == 0);
+  handler.resume_recv();
+  poller->poll(100ms);
+  CHECK(handler.received == 1);
+
+  handler.close();
+  ::close(sv[1]);
+}
+
+TEST_CASE("TCPSocketHandler paused peer close")
+{
+  auto poller = std::make_shared<Poller>();
+  int sv[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  WatermarkSocketHandler handler(poller, sv[0]);
+  handler.add_to_poller();
+
+  // The hang-up is reported even though we don’t watch receive events
+  handler.pause_recv();
+  ::close(sv[1]);
+  for (int i = 0; i < 10 && handler.close_count == 0; ++i)
+    poller->poll(10ms);
+  CHECK(handler.close_count == 1);
+  CHECK(handler.get_socket() == -1);
+  CHECK(poller->size() == 0);
+}
+
+TEST_CASE("TCPSocketHandler full kernel buffer")
+{
+  auto poller = std::make_shared<Poller>();
+  int sv[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+  WatermarkSocketHandler handler(poller, sv[0]);
+  handler.add_to_poller();
+
+  // Much more than what the kernel accepts at once: the rest must be sent
+  // when the peer reads, after a send event
+  constexpr std::size_t size = 8 * 1024 * 1024;
+  handler.send_data(std::string(size, 'a'));
+  poller->poll(10ms);
+  CHECK(handler.get_output_size() > 0);
+  CHECK(handler.get_output_size() < size);
+
+  std::size_t received = 0;
+  std::vector<char> buf(64 * 1024);
+  for (int i = 0; i < 10000 && received < size; ++i)
+    {
+      const auto res = ::recv(sv[1], buf.data(), buf.size(), 0);
+      if (res > 0)
+        received += static_cast<std::size_t>(res);
+      poller->poll(10ms);
+    }
+  CHECK(received == size);
+  CHECK(handler.get_output_size() == 0);
+
+  handler.close();
+  ::close(sv[1]);
+}
+
+#if POLLER == IO_URING
+namespace
+{
+  /**
+   * Records what the poller gives it, when it does the reads and writes
+   * itself
+   */
+  class RingSocketHandler: public SocketHandler
+  {
+  public:
+    RingSocketHandler(std::shared_ptr<Poller>& poller, const socket_t socket):
+      SocketHandler(poller, socket)
+    {}
+    ~RingSocketHandler()
+    {
+      ::close(this->socket);
+    }
+    void on_recv() override
+    { this->fallback_count++; }
+    void on_send() override
+    { this->fallback_count++; }
+    bool is_connected() const override
+    { return true; }
+    bool accepts_poller_io() const override
+    { return true; }
+    void on_recv_result(const char* data, const ssize_t res) override
+    {
+      this->recv_results.push_back(res);
+      if (res > 0)
+        this->received.append(data, static_cast<std::size_t>(res));
+    }
+    std::size_t prepare_send(struct iovec* iovecs, const std::size_t max_iovecs,
+                             std::vector<OutputBuffer::Chunk>& chunks) override
+    {
+      return this->out_buf.fill_iovecs(iovecs, max_iovecs, chunks);
+    }
+    void on_send_result(const ssize_t res) override
+    {
+      this->send_results.push_back(res);
+    }
+    OutputBuffer out_buf;
+    std::string received;
+    std::vector<ssize_t> recv_results;
+    std::vector<ssize_t> send_results;
+    int fallback_count{0};
+  };
+}
+
+TEST_CASE("io_uring poller")
+{
+  auto poller = std::make_shared<Poller>();
+  // Otherwise, we would only be testing the epoll fallback
+  REQUIRE(poller->is_using_io_uring());
+  int sv[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+  RingSocketHandler handler(poller, sv[0]);
+  poller->add_socket_handler(&handler);
+
+  ::send(sv[1], "hello", 5, 0);
+  poller->poll(100ms);
+  CHECK(handler.received == "hello");
+
+  // The chunks are kept alive by the poller until they are sent, even if
+  // the SocketHandler forgets about them
+  handler.out_buf.push("coucou"s);
+  poller->watch_send_events(&handler);
+  poller->poll(0ms);
+  handler.out_buf.clear();
+  for (int i = 0; i < 10 && handler.send_results.empty(); ++i)
+    poller->poll(10ms);
+  CHECK(handler.send_results == std::vector<ssize_t>{6});
+  char buf[16];
+  CHECK(::recv(sv[1], buf, sizeof(buf), 0) == 6);
+  CHECK(std::string(buf, 6) == "coucou");
+
+  // The data received before we stop watching receive events is handled
+  // only once we watch them again
+  poller->stop_watching_recv_events(&handler);
+  ::send(sv[1], "a", 1, 0);
+  poller->poll(10ms);
+  CHECK(handler.received == "hello");
+  poller->watch_recv_events(&handler);
+  for (int i = 0; i < 10 && handler.received.size() == 5; ++i)
+    poller->poll(10ms);
+  CHECK(handler.received == "helloa");
+
+  // The end of the connection is reported too
+  ::close(sv[1]);
+  for (int i = 0; i < 10 && handler.recv_results.back() != 0; ++i)
+    poller->poll(10ms);
+  CHECK(handler.recv_results.back() == 0);
+  CHECK(handler.fallback_count == 0);
+  poller->remove_socket_handler(handler.get_socket());
+}
+#endif
+
+TEST_CASE("TCPClientSocketHandler")
+{
+  SECTION("Address families are interleaved")
+    {
+      struct sockaddr_in6 addr6{};
+      struct sockaddr_in addr4{};
+      struct addrinfo ai[5]{};
+      const int families[] = {AF_INET6, AF_INET6, AF_INET6, AF_INET, AF_INET};
+      for (int i = 0; i < 5; ++i)
+        {
+          ai[i].ai_family = families[i];
+          ai[i].ai_addr = families[i] == AF_INET6 ? reinterpret_cast<struct sockaddr*>(&addr6):
+              reinterpret_cast<struct sockaddr*>(&addr4);
+          ai[i].ai_next = i < 4 ? &ai[i + 1] : nullptr;
+        }
+      auto res = sort_addresses(ai, AF_UNSPEC);
+      CHECK(res == std::vector<const struct addrinfo*>{&ai[0], &ai[3], &ai[1], &ai[4], &ai[2]});
+      res = sort_addresses(ai, AF_INET);
+      CHECK(res == std::vector<const struct addrinfo*>{&ai[3], &ai[0], &ai[4], &ai[1], &ai[2]});
+      CHECK(sort_addresses(nullptr, AF_UNSPEC).empty());
+    }
+  SECTION("Connection")
+    {
+      auto poller = std::make_shared<Poller>();
+      const int server = ::socket(AF_INET, SOCK_STREAM, 0);
+      REQUIRE(server != -1);
+      struct sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socklen_t len = sizeof(addr);
+      REQUIRE(::bind(server, reinterpret_cast<struct sockaddr*>(&addr), len) == 0);
+      REQUIRE(::getsockname(server, reinterpret_cast<struct sockaddr*>(&addr), &len) == 0);
+      const auto port = std::to_string(ntohs(addr.sin_port));
+
+      ClientSocketHandler client(poller);
+      auto run = [&poller, &client]()
+      {
+        for (int i = 0; i < 100 && client.connected_count == 0 && client.failure.empty(); ++i)
+          {
+            TimedEventsManager::instance().execute_expired_events();
+            poller->poll(10ms);
+          }
+      };
+      // Nobody listens yet
+      client.connect("127.0.0.1", port, false);
+      run();
+      CHECK(client.connected_count == 0);
+      CHECK_FALSE(client.failure.empty());
+      CHECK_FALSE(client.is_connecting());
+
+      REQUIRE(::listen(server, 10) == 0);
+      client.failure.clear();
+      client.connect("127.0.0.1", port, false);
+      run();
+      CHECK(client.connected_count == 1);
+      CHECK(client.failure.empty());
+      CHECK(client.is_connected());
+      CHECK(poller->size() == 1);
+
+      client.close();
+      TimedEventsManager::instance().execute_expired_events();
+      CHECK(poller->size() == 0);
+      ::close(server);
+    }
+#ifndef UDNS_FOUND
+  // With udns, the hostname would not be looked up in the DnsCache
+  SECTION("A later attempt wins")
+    {
+      auto poller = std::make_shared<Poller>();
+      // The same port on both addresses
+      const int server4 = ::socket(AF_INET, SOCK_STREAM, 0);
+      REQUIRE(server4 != -1);
+      struct sockaddr_in addr4{};
+      addr4.sin_family = AF_INET;
+      addr4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socklen_t len4 = sizeof(addr4);
+      REQUIRE(::bind(server4, reinterpret_cast<struct sockaddr*>(&addr4), len4) == 0);
+      REQUIRE(::getsockname(server4, reinterpret_cast<struct sockaddr*>(&addr4), &len4) == 0);
+      REQUIRE(::listen(server4, 10) == 0);
+      const int server6 = ::socket(AF_INET6, SOCK_STREAM, 0);
+      REQUIRE(server6 != -1);
+      int v6only = 1;
+      ::setsockopt(server6, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+      struct sockaddr_in6 addr6{};
+      addr6.sin6_family = AF_INET6;
+      addr6.sin6_addr = in6addr_loopback;
+      addr6.sin6_port = addr4.sin_port;
+      REQUIRE(::bind(server6, reinterpret_cast<struct sockaddr*>(&addr6), sizeof(addr6)) == 0);
+      // With a full accept queue, the connections to the IPv6 address
+      // are never answered
+      REQUIRE(::listen(server6, 0) == 0);
+      const int filler = ::socket(AF_INET6, SOCK_STREAM, 0);
+      REQUIRE(::connect(filler, reinterpret_cast<struct sockaddr*>(&addr6), sizeof(addr6)) == 0);
+
+      DnsCache::Entry entry;
+      entry.addresses = {"::1", "127.0.0.1"};
+      entry.expiration = std::chrono::steady_clock::now() + 1min;
+      DnsCache::instance().store("happy.eyeballs.test", entry);
+
+      auto count_fds = []()
+      {
+        int res = 0;
+        for (int fd = 0; fd < 1024; ++fd)
+          if (::fcntl(fd, F_GETFD) != -1)
+            res++;
+        return res;
+      };
+      const auto fds = count_fds();
+
+      ClientSocketHandler client(poller);
+      const auto start = std::chrono::steady_clock::now();
+      client.connect("happy.eyeballs.test", std::to_string(ntohs(addr4.sin_port)), false);
+      // The IPv6 attempt, which never completes
+      CHECK(poller->size() == 1);
+      for (int i = 0; i < 100 && client.connected_count == 0 && client.failure.empty(); ++i)
+        {
+          TimedEventsManager::instance().execute_expired_events();
+          poller->poll(10ms);
+        }
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      CHECK(client.connected_count == 1);
+      CHECK(client.failure.empty());
+      // The IPv4 attempt was started after the connection attempt delay,
+      // without waiting for the first one to time out
+      CHECK(elapsed >= 250ms);
+      CHECK(elapsed < 1s);
+
+      // The IPv6 attempt is abandoned: its socket is closed, and no longer
+      // watched
+      CHECK(poller->size() == 1);
+      CHECK(count_fds() == fds + 1);
+      TimedEventsManager::instance().execute_expired_events();
+      CHECK(count_fds() == fds + 1);
+      const int accepted = ::accept(server4, nullptr, nullptr);
+      CHECK(accepted != -1);
+
+      // IPv4 is tried first the next time
+      client.close();
+      TimedEventsManager::instance().execute_expired_events();
+      client.connect("happy.eyeballs.test", std::to_string(ntohs(addr4.sin_port)), false);
+      for (int i = 0; i < 100 && client.connected_count == 1; ++i)
+        poller->poll(10ms);
+      CHECK(client.connected_count == 2);
+      CHECK(std::chrono::steady_clock::now() - start - elapsed < 250ms);
+
+      client.close();
+      TimedEventsManager::instance().execute_expired_events();
+      DnsCache::instance().clear();
+      ::close(accepted);
+      ::close(filler);
+      ::close(server6);
+      ::close(server4);
+    }
+#endif
+}
+
+TEST_CASE("DnsCache")
+{
+  auto& cache = DnsCache::instance();
+  cache.clear();
+  const auto hits = cache.get_hits();
+  const auto misses = cache.get_misses();
+
+  const auto addresses = cache.resolve("localhost").addresses;
+  CHECK_FALSE(addresses.empty());
+  CHECK(cache.get_misses() == misses + 1);
+  CHECK(cache.size() == 1);
+
+  // Hostnames are case-insensitive
+  CHECK(cache.resolve("LocalHost").addresses == addresses);
+  CHECK(cache.get_hits() == hits + 1);
+  CHECK(cache.get_misses() == misses + 1);
+
+#ifndef UDNS_FOUND
+  // With udns, the Resolver does not use that cache
+  Resolver resolver;
+  bool resolved = false;
+  resolver.resolve("localhost", "6667", [&resolved](const struct addrinfo* addr)
+                   {
+                     resolved = addr != nullptr;
+                   }, [](const char*) {});
+  CHECK(resolved);
+  CHECK(cache.get_hits() == hits + 2);
+#endif
+
+  cache.clear();
+  CHECK(cache.size() == 0);
+}
+
+#ifdef TIMERFD_FOUND
+TEST_CASE("TimerSocketHandler")
+{
+  auto poller = std::make_shared<Poller>();
+  TimerSocketHandler timer(poller);
+  CHECK(poller->size() == 1);
+  timer.update();
+
+  int executed = 0;
+  const auto start = std::chrono::steady_clock::now();
+  TimedEventsManager::instance().add_event(TimedEvent(start + 20ms, [&executed]() { executed++; }, "", 10ms));
+  TimedEventsManager::instance().add_event(TimedEvent(start + 25ms, [&executed]() { executed++; }, "", 10ms));
+  timer.update();
+  // Both events are executed after the same wakeup, at the deadline of
+  // the first one
+  while (!timer.consume_expiration() && std::chrono::steady_clock::now() - start < 1s)
+    poller->poll(utils::no_timeout);
+  // The events are only executed once poll() returned
+  CHECK(executed == 0);
+  TimedEventsManager::instance().execute_expired_events();
+  CHECK(executed == 2);
+  CHECK(std::chrono::steady_clock::now() - start >= 25ms);
+  CHECK(TimedEventsManager::instance().size() == 0);
+
+  timer.update();
+  CHECK(poller->poll(0ms) == 0);
+  CHECK_FALSE(timer.consume_expiration());
+  CHECK(executed == 2);
+
+  SECTION("An event destroys a socket handler of the same batch")
+    {
+      // Like the connection attempts retired by a TCPClientSocketHandler,
+      // destroyed by an event at the time they are retired
+      int fds_a[2];
+      int fds_b[2];
+      REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds_a) == 0);
+      REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds_b) == 0);
+      auto a = std::make_unique<CountingSocketHandler>(poller, fds_a[0]);
+      CountingSocketHandler b(poller, fds_b[0]);
+      poller->add_socket_handler(a.get());
+      poller->add_socket_handler(&b);
+      TimedEventsManager::instance().add_event(TimedEvent(std::chrono::steady_clock::now() + 10ms,
+                                                          [&poller, &a]()
+                                                          {
+                                                            poller->remove_socket_handler(a->get_socket());
+                                                            a.reset();
+                                                          }));
+      timer.update();
+      // b is ready, then the timer, then a
+      ::send(fds_b[1], "b", 1, 0);
+      std::this_thread::sleep_for(20ms);
+      ::send(fds_a[1], "a", 1, 0);
+      poller->poll(100ms);
+      REQUIRE(a);
+      CHECK(a->recv_count == 1);
+      CHECK(b.recv_count == 1);
+      CHECK(timer.consume_expiration());
+      TimedEventsManager::instance().execute_expired_events();
+      CHECK_FALSE(a);
+      CHECK(poller->size() == 2);
+
+      poller->remove_socket_handler(b.get_socket());
+      ::close(fds_a[1]);
+      ::close(fds_b[1]);
+    }
+}
+#endif
+
+TEST_CASE("OutputBuffer")
+{
+  OutputBuffer buffer;
+  CHECK(buffer.empty());
+  const auto shared = std::make_shared<const std::string>("shared");
+  buffer.push("hello "s);
+  buffer.push(std::string{});
+  buffer.push(shared);
+  buffer.push("!"s);
+  CHECK(buffer.size() == 13);
+  CHECK(shared.use_count() == 2);
+
+  struct iovec iovecs[2];
+  REQUIRE(buffer.fill_iovecs(iovecs, 2) == 2);
+  CHECK(std::string(static_cast<const char*>(iovecs[0].iov_base), iovecs[0].iov_len) == "hello ");
+  CHECK(iovecs[1].iov_base == shared->data());
+
+  // A partial write only moves the offset into the chunk
+  buffer.consume(8);
+  CHECK(buffer.size() == 5);
+  REQUIRE(buffer.fill_iovecs(iovecs, 2) == 2);
+  CHECK(std::string(static_cast<const char*>(iovecs[0].iov_base), iovecs[0].iov_len) == "ared");
+  CHECK(iovecs[0].iov_base == shared->data() + 2);
+  CHECK(std::string(static_cast<const char*>(iovecs[1].iov_base), iovecs[1].iov_len) == "!");
+
+  buffer.consume(4);
+  CHECK(shared.use_count() == 1);
+  buffer.consume(1);
+  CHECK(buffer.empty());
+  CHECK(buffer.size() == 0);
+
+  buffer.push("abc"s);
+  buffer.clear();
+  CHECK(buffer.empty());
+  CHECK(buffer.fill_iovecs(iovecs, 2) == 0);
+}
+
+TEST_CASE("ReceiveBuffer")
+{
+  ReceiveBuffer buffer;
+  CHECK(buffer.empty());
+  CHECK(buffer.find('\n') == std::string::npos);
+  buffer.append("PING :a\r\nPING :b\r\nPI", 20);
+  CHECK(buffer.size() == 20);
+  CHECK(buffer.find("\r\n"s) == 7);
+  CHECK(buffer.find("\r\n"s, 8) == 16);
+  CHECK(buffer.find('b') == 15);
+  CHECK(buffer.substr(0, 7) == "PING :a");
+
+  buffer.consume(9);
+  CHECK(buffer.substr(0, buffer.find("\r\n"s)) == "PING :b");
+  buffer.consume(9);
+  CHECK(buffer.substr(0) == "PI");
+  CHECK(buffer.find("\r\n"s) == std::string::npos);
+
+  // Writing directly into the free space, which moves the remaining data
+  // back to the start of the storage if needed
+  char* free_space = buffer.prepare(4096);
+  REQUIRE(buffer.free_space() >= 4096);
+  std::memcpy(free_space, "NG :c\r\n", 7);
+  buffer.commit(7);
+  CHECK(buffer.substr(0) == "PING :c\r\n");
+  buffer.consume(9);
+  CHECK(buffer.empty());
+
+  buffer.append("abc", 3);
+  CHECK(buffer.find("bc") == 1);
+  CHECK(buffer.find("c\0", 0, 2) == std::string::npos);
+  buffer.clear();
+  CHECK(buffer.size() == 0);
+  // A small storage is kept for the next read
+  CHECK(buffer.free_space() >= 4096);
+
+  // A big one is released once everything is consumed
+  const std::string big(ReceiveBuffer::max_idle_capacity * 2, 'a');
+  buffer.append(big.data(), big.size());
+  buffer.consume(big.size() - 1);
+  CHECK(buffer.substr(0) == "a");
+  buffer.consume(1);
+  CHECK(buffer.free_space() == 0);
+}
 
 #ifdef BOTAN_FOUND
 TEST_CASE("tls_policy")
@@ -42,4 +716,40 @@ TEST_CASE("tls_policy")
         }
     }
 }
+
+TEST_CASE("tls_policy cache")
+{
+  char directory_template[] = "/tmp/biboumi_tls_policy_XXXXXX";
+  REQUIRE(::mkdtemp(directory_template) != nullptr);
+  const std::string directory = directory_template + "/"s;
+  const std::string global_path = directory + "policy.txt";
+  const std::string specific_path = directory + "irc.example.com.policy.txt";
+  std::ofstream(global_path) << "minimum_rsa_bits=12\n";
+  std::ofstream(specific_path) << "minimum_signature_strength=15\n";
+
+  const auto policy = get_tls_policy(directory, "irc.example.com");
+  CHECK(policy->minimum_rsa_bits() == 12);
+  CHECK(policy->minimum_signature_strength() == 15);
+  CHECK(get_tls_policy(directory, "irc.example.com") == policy);
+
+  // The addresses without a specific file share the global policy
+  const auto global_policy = get_tls_policy(directory, "irc.example.org");
+  CHECK(global_policy != policy);
+  CHECK(global_policy->minimum_rsa_bits() == 12);
+  CHECK(get_tls_policy(directory, "irc.example.net") == global_policy);
+
+  // A file rewritten right away, within the same second, is parsed again
+  std::ofstream(specific_path) << "minimum_signature_strength=110\n";
+  const auto new_policy = get_tls_policy(directory, "irc.example.com");
+  CHECK(new_policy != policy);
+  CHECK(new_policy->minimum_signature_strength() == 110);
+
+  clear_tls_policy_cache();
+  CHECK(get_tls_policy(directory, "irc.example.com") != new_policy);
+
+  ::unlink(global_path.data());
+  ::unlink(specific_path.data());
+  ::rmdir(directory_template);
+  clear_tls_policy_cache();
+}
 #endif
@@ -2,6 +2,8 @@
 
 #include <utils/timed_events.hpp>
 
+#include <algorithm>
+
 /**
  * Let Catch know how to display std::chrono::duration values
  */
@@ -59,3 +61,152 @@ TEST_CASE("Test timed event cancellation")
   CHECK(TimedEventsManager::instance().cancel("deux") == 2);
   CHECK(TimedEventsManager::instance().get_timeout() == utils::no_timeout);
 }
+
+TEST_CASE("Test timed event handles")
+{
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  using time_point = std::chrono::steady_clock::time_point;
+  std::vector<int> executed;
+  const auto one = TimedEventsManager::instance().add_event(TimedEvent(time_point(now), [&executed](){ executed.push_back(1); }, "same"));
+  const auto two = TimedEventsManager::instance().add_event(TimedEvent(time_point(now), [&executed](){ executed.push_back(2); }, "same"));
+  const auto three = TimedEventsManager::instance().add_event(TimedEvent(time_point(now), [&executed](){ executed.push_back(3); }));
+  CHECK(one != two);
+  CHECK(TimedEventsManager::instance().find_event(two) != nullptr);
+
+  CHECK(TimedEventsManager::instance().cancel(two));
+  CHECK_FALSE(TimedEventsManager::instance().cancel(two));
+  CHECK(TimedEventsManager::instance().find_event(two) == nullptr);
+  CHECK(TimedEventsManager::instance().find_event("same") == TimedEventsManager::instance().find_event(one));
+  CHECK(TimedEventsManager::instance().size() == 2);
+
+  // The events expiring at the same time are executed in the order they
+  // were added
+  CHECK(TimedEventsManager::instance().execute_expired_events() == 2);
+  CHECK(executed == std::vector<int>{1, 3});
+  CHECK_FALSE(TimedEventsManager::instance().cancel(three));
+  CHECK(TimedEventsManager::instance().find_event("same") == nullptr);
+  CHECK(TimedEventsManager::instance().get_timeout() == utils::no_timeout);
+
+  SECTION("A repeated event can cancel itself")
+    {
+      int count = 0;
+      TimedEventHandle handle = 0;
+      handle = TimedEventsManager::instance().add_event(TimedEvent(0ms, [&count, &handle]() {
+            if (++count == 3)
+              TimedEventsManager::instance().cancel(handle);
+          }, "repeated"));
+      for (int i = 0; i < 5; ++i)
+        TimedEventsManager::instance().execute_expired_events();
+      CHECK(count == 3);
+      CHECK(TimedEventsManager::instance().size() == 0);
+      CHECK(TimedEventsManager::instance().find_event("repeated") == nullptr);
+    }
+}
+
+TEST_CASE("Test timed event slack")
+{
+  using time_point = std::chrono::steady_clock::time_point;
+  const time_point now = std::chrono::steady_clock::now();
+  auto& manager = TimedEventsManager::instance();
+  CHECK(manager.get_next_deadline() == time_point::max());
+
+  const auto one = manager.add_event(TimedEvent(time_point(now + 10s), [](){}, "", 5s));
+  CHECK(manager.get_next_deadline() == now + 15s);
+  // An event expiring later, but without slack, must be executed first
+  const auto two = manager.add_event(TimedEvent(time_point(now + 12s), [](){}));
+  CHECK(manager.get_next_deadline() == now + 12s);
+  CHECK(manager.get_timeout() > 11s);
+  CHECK(manager.get_timeout() <= 12s);
+  manager.cancel(two);
+  CHECK(manager.get_next_deadline() == now + 15s);
+  manager.cancel(one);
+  CHECK(manager.get_next_deadline() == time_point::max());
+  CHECK(manager.get_timeout() == utils::no_timeout);
+}
+
+/**
+ * The sorted vector the TimedEventsManager used before, to compare it with
+ * the current implementation. Run with `test_suite [benchmark]`.
+ */
+namespace
+{
+  struct SortedEvents
+  {
+    struct Event
+    {
+      std::chrono::steady_clock::time_point time_point;
+      std::function<void()> callback;
+      std::string name;
+    };
+    std::vector<Event> events;
+
+    void add_event(Event&& event)
+    {
+      for (auto it = this->events.begin(); it != this->events.end(); ++it)
+        if (it->time_point > event.time_point)
+          {
+            this->events.emplace(it, std::move(event));
+            return;
+          }
+      this->events.emplace_back(std::move(event));
+    }
+    std::size_t cancel(const std::string& name)
+    {
+      const auto size = this->events.size();
+      this->events.erase(std::remove_if(this->events.begin(), this->events.end(),
+                                        [&name](const Event& event) { return event.name == name; }),
+                         this->events.end());
+      return size - this->events.size();
+    }
+  };
+}
+
+TEST_CASE("Timed events benchmark", "[.benchmark]")
+{
+  constexpr int number = 10000;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::string> names;
+  for (int i = 0; i < number; ++i)
+    names.push_back("PING" + std::to_string(i) + "irc.example.com" + "user" + std::to_string(i) + "@example.com");
+
+  const auto measure = [](auto&& function) {
+    const auto begin = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+  };
+
+  SortedEvents sorted;
+  const auto sorted_add = measure([&]() {
+      for (int i = 0; i < number; ++i)
+        sorted.add_event({start + std::chrono::seconds((i * 7919) % 3600), [](){}, names[static_cast<std::size_t>(i)]});
+    });
+  const auto sorted_cancel = measure([&]() {
+      for (int i = 0; i < number; ++i)
+        sorted.cancel(names[static_cast<std::size_t>(i)]);
+    });
+
+  auto& manager = TimedEventsManager::instance();
+  const auto manager_add = measure([&]() {
+      for (int i = 0; i < number; ++i)
+        manager.add_event(TimedEvent(start + std::chrono::seconds((i * 7919) % 3600), [](){}, names[static_cast<std::size_t>(i)]));
+    });
+  const auto manager_cancel = measure([&]() {
+      for (int i = 0; i < number; ++i)
+        manager.cancel(names[static_cast<std::size_t>(i)]);
+    });
+  std::vector<TimedEventHandle> handles;
+  const auto handle_add = measure([&]() {
+      for (int i = 0; i < number; ++i)
+        handles.push_back(manager.add_event(TimedEvent(start + std::chrono::seconds((i * 7919) % 3600), [](){})));
+    });
+  const auto handle_cancel = measure([&]() {
+      for (const auto handle: handles)
+        manager.cancel(handle);
+    });
+  CHECK(manager.size() == 0);
+  CHECK(sorted.events.empty());
+
+  WARN(number << " events, sorted vector: add " << sorted_add.count() << "ms, cancel by name " << sorted_cancel.count() << "ms");
+  WARN(number << " events, TimedEventsManager: add " << manager_add.count() << "ms, cancel by name " << manager_cancel.count() << "ms");
+  WARN(number << " events, TimedEventsManager: add " << handle_add.count() << "ms, cancel by handle " << handle_cancel.count() << "ms");
+}
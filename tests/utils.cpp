@@ -12,6 +12,10 @@
 #include <utils/scopeguard.hpp>
 #include <utils/dirname.hpp>
 #include <utils/is_one_of.hpp>
+#include <utils/spsc_queue.hpp>
+#include <utils/tokens_bucket.hpp>
+
+#include <thread>
 
 using namespace std::string_literals;
 
@@ -186,3 +190,87 @@ TEST_CASE("is_in")
   CHECK((is_one_of<bool, bool>) == true);
   CHECK((is_one_of<bool, bool, bool, bool, bool, int>) == true);
 }
+
+TEST_CASE("spsc_queue")
+{
+  utils::SpscQueue<int> queue(3);
+  CHECK(queue.capacity() == 4);
+  CHECK(queue.empty());
+  int value;
+  CHECK_FALSE(queue.pop(value));
+  for (int i = 0; i < 4; ++i)
+    CHECK(queue.push(int{i}));
+  CHECK_FALSE(queue.push(42));
+  CHECK(queue.pop(value));
+  CHECK(value == 0);
+  CHECK(queue.push(4));
+  for (int i = 1; i < 5; ++i)
+    {
+      CHECK(queue.pop(value));
+      CHECK(value == i);
+    }
+  CHECK(queue.empty());
+
+  SECTION("Two threads")
+    {
+      constexpr int count = 100000;
+      utils::SpscQueue<int> shared(64);
+      std::thread producer([&shared]()
+                           {
+                             for (int i = 0; i < count; ++i)
+                               while (!shared.push(int{i}))
+                                 std::this_thread::yield();
+                           });
+      int expected = 0;
+      while (expected < count)
+        {
+          if (shared.pop(value))
+            {
+              if (value != expected)
+                break;
+              expected++;
+            }
+          else
+            std::this_thread::yield();
+        }
+      producer.join();
+      CHECK(expected == count);
+    }
+}
+
+TEST_CASE("tokens_bucket")
+{
+  int called = 0;
+  {
+    TokensBucket bucket(2, 20ms, [&called]() { called++; });
+    // No event is needed while nobody waits for a token
+    CHECK(TimedEventsManager::instance().size() == 0);
+    CHECK(bucket.use_token());
+    CHECK(bucket.use_token());
+    CHECK_FALSE(bucket.use_token());
+
+    bucket.wait_for_token();
+    bucket.wait_for_token();
+    CHECK(TimedEventsManager::instance().size() == 1);
+    const auto timeout = TimedEventsManager::instance().get_timeout();
+    CHECK(timeout > 0ms);
+    CHECK(timeout <= 20ms);
+    std::this_thread::sleep_for(timeout + 1ms);
+    CHECK(TimedEventsManager::instance().execute_expired_events() == 1);
+    CHECK(called == 1);
+    CHECK(bucket.use_token());
+    CHECK_FALSE(bucket.use_token());
+
+    // The bucket never contains more than its limit
+    std::this_thread::sleep_for(70ms);
+    CHECK(bucket.use_token());
+    CHECK(bucket.use_token());
+    CHECK_FALSE(bucket.use_token());
+
+    bucket.set_limit(-1);
+    CHECK(bucket.use_token());
+    bucket.wait_for_token();
+  }
+  // The bucket cancels its event when it’s destroyed
+  CHECK(TimedEventsManager::instance().size() == 0);
+}
@@ -1,7 +1,28 @@
 #include "catch.hpp"
 
+#include <biboumi.h>
+
 #include <xmpp/xmpp_parser.hpp>
 #include <xmpp/auth.hpp>
+#include <xmpp/atoms.hpp>
+#include <xmpp/xmpp_component.hpp>
+#include <xmpp/biboumi_component.hpp>
+#include <bridge/bridge.hpp>
+#include <network/poller.hpp>
+#ifdef USE_DATABASE
+# include <database/database.hpp>
+#endif
+#include <utils/encoding.hpp>
+
+#include <chrono>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
 
 TEST_CASE("Test basic XML parsing")
 {
@@ -42,6 +63,112 @@ TEST_CASE("Test basic XML parsing")
   xml.feed(doc2.data(), static_cast<int>(doc.size()), true);
 }
 
+TEST_CASE("XML parser reuses the nodes")
+{
+  XmppParser xml;
+  std::vector<std::string> stanzas;
+  xml.add_stanza_callback([&stanzas](const Stanza& stanza)
+      {
+        stanzas.push_back(stanza.to_string());
+      });
+  std::string doc = "<stream xmlns='s'>"
+      "<message a='b' c='d'>inner<body>body</body>tail<x xmlns='ns'><y/><z/></x></message>"
+      "<iq/>"
+      "<presence from='f'>text<x xmlns='ns'/></presence>"
+      "<message>" + std::string(10000, 'a') + "</message>"
+      "<message a='e'>";
+  for (int i = 0; i < 300; ++i)
+    doc += "<a>" + std::to_string(i) + "</a>";
+  doc += "</message><message/>";
+  xml.feed(doc.data(), static_cast<int>(doc.size()), false);
+
+  REQUIRE(stanzas.size() == 6);
+  CHECK(stanzas[0] == "<message a='b' c='d' xmlns='s'>inner<body xmlns='s'>body</body>tail<x xmlns='ns'><y xmlns='ns'/><z xmlns='ns'/></x></message>");
+  CHECK(stanzas[1] == "<iq xmlns='s'/>");
+  CHECK(stanzas[2] == "<presence from='f' xmlns='s'>text<x xmlns='ns'/></presence>");
+  CHECK(stanzas[3] == "<message xmlns='s'>" + std::string(10000, 'a') + "</message>");
+  CHECK(stanzas[4].size() > 300 * 7);
+  CHECK(stanzas[5] == "<message xmlns='s'/>");
+}
+
+TEST_CASE("XmlNode attributes")
+{
+  Stanza node("message");
+  CHECK(node.get_tag("to").empty());
+  CHECK_FALSE(node.del_tag("to"));
+  node["to"] = "b";
+  node.set_attribute("from", "a");
+  node["type"] = "chat";
+  node["id"] = "1";
+  CHECK(node.get_tag("to") == "b");
+  CHECK(node.get_tag("from") == "a");
+  CHECK(node.get_tag("t").empty());
+  CHECK(node.get_tag("zzz").empty());
+  node["to"] = "c";
+  CHECK(node.to_string() == "<message from='a' id='1' to='c' type='chat'/>");
+  CHECK(node.del_tag("id"));
+  CHECK_FALSE(node.del_tag("id"));
+  CHECK(node.get_tag("id").empty());
+  CHECK(Stanza(node).to_string() == "<message from='a' to='c' type='chat'/>");
+}
+
+TEST_CASE("Atoms")
+{
+  const std::vector<std::pair<Atom, std::string>> known = {
+    {atoms::stream_ns, STREAM_NS}, {atoms::component_ns, COMPONENT_NS}, {atoms::muc_ns, MUC_NS},
+    {atoms::muc_user_ns, MUC_USER_NS}, {atoms::muc_admin_ns, MUC_ADMIN_NS}, {atoms::muc_owner_ns, MUC_OWNER_NS},
+    {atoms::disco_ns, DISCO_NS}, {atoms::disco_items_ns, DISCO_ITEMS_NS}, {atoms::disco_info_ns, DISCO_INFO_NS},
+    {atoms::xhtmlim_ns, XHTMLIM_NS}, {atoms::stanza_ns, STANZA_NS}, {atoms::streams_ns, STREAMS_NS},
+    {atoms::version_ns, VERSION_NS}, {atoms::adhoc_ns, ADHOC_NS}, {atoms::ping_ns, PING_NS},
+    {atoms::delay_ns, DELAY_NS}, {atoms::mam_ns, MAM_NS}, {atoms::forward_ns, FORWARD_NS},
+    {atoms::client_ns, CLIENT_NS}, {atoms::dataform_ns, DATAFORM_NS}, {atoms::rsm_ns, RSM_NS},
+    {atoms::muc_traffic_ns, MUC_TRAFFIC_NS}, {atoms::stable_id_ns, STABLE_ID_NS},
+    {atoms::stable_muc_id_ns, STABLE_MUC_ID_NS}, {atoms::message, "message"}, {atoms::presence, "presence"},
+    {atoms::iq, "iq"}, {atoms::handshake, "handshake"}, {atoms::error, "error"},
+  };
+  CHECK(known.size() == atoms::count - 1);
+  for (const auto& pair: known)
+    {
+      CHECK(atoms::get(pair.first) == pair.second);
+      CHECK(atoms::find(pair.second) == pair.first);
+    }
+  CHECK(atoms::find("") == atoms::none);
+  CHECK(atoms::find("urn:example:unknown") == atoms::none);
+  CHECK(atoms::get(atoms::none).empty());
+
+  XmppParser xml;
+  bool called = false;
+  xml.add_stanza_callback([&called](const Stanza& stanza)
+      {
+        called = true;
+        CHECK(stanza.get_name_atom() == atoms::iq);
+        CHECK(stanza.get_xmlns_atom() == atoms::component_ns);
+        CHECK(stanza.get_child("query", atoms::disco_info_ns) == nullptr);
+        const XmlNode* query = stanza.get_child("query", atoms::disco_items_ns);
+        REQUIRE(query != nullptr);
+        CHECK(query->get_children("item", atoms::disco_items_ns).size() == 2);
+        CHECK(query->get_children("item", atoms::none).empty());
+        CHECK(query->get_child("x", atoms::none) != nullptr);
+      });
+  const std::string doc = "<stream xmlns='" COMPONENT_NS "'><iq><query xmlns='" DISCO_ITEMS_NS "'>"
+      "<item/><item/><x xmlns='urn:example:unknown'/></query></iq>";
+  xml.feed(doc.data(), static_cast<int>(doc.size()), false);
+  CHECK(called);
+
+  Stanza node("message");
+  CHECK(node.get_name_atom() == atoms::message);
+  CHECK(node.get_xmlns_atom() == atoms::none);
+  node["xmlns"] = MUC_NS;
+  CHECK(node.get_xmlns_atom() == atoms::muc_ns);
+  node.set_name("presence");
+  CHECK(node.get_name_atom() == atoms::presence);
+  node.del_tag("xmlns");
+  CHECK(node.get_xmlns_atom() == atoms::none);
+  XmlSubNode(node, MUC_USER_NS, "x");
+  CHECK(node.get_child("x", atoms::muc_user_ns) != nullptr);
+  CHECK(Stanza(node).get_child("x", atoms::muc_user_ns) != nullptr);
+}
+
 TEST_CASE("XML escape")
 {
   const std::string unescaped = R"('coucou'<cc>/&"gaga")";
@@ -72,3 +199,257 @@ TEST_CASE("substanzas")
   }
   CHECK(a.has_children());
 }
+
+/**
+ * A stanza, serialized the way XmlNode::to_string did before it used
+ * XmlNode::serialize (with an ostringstream, and sanitize() calling
+ * is_valid_utf8, remove_invalid_xml_chars and xml_escape), to compare both
+ * of them.
+ */
+namespace
+{
+  std::string old_sanitize(const std::string& data)
+  {
+    if (utils::is_valid_utf8(data.data()))
+      return xml_escape(utils::remove_invalid_xml_chars(data));
+    else
+      return xml_escape(utils::remove_invalid_xml_chars(utils::convert_to_utf8(data, "ISO-8859-1")));
+  }
+
+  struct Node
+  {
+    std::string name;
+    std::map<std::string, std::string> attributes;
+    std::string inner;
+    std::vector<Node> children;
+    std::string tail;
+
+    std::string to_string() const
+    {
+      std::ostringstream res;
+      res << "<" << this->name;
+      for (const auto& it: this->attributes)
+        res << " " << it.first << "='" << old_sanitize(it.second) + "'";
+      if (this->children.empty() && this->inner.empty())
+        res << "/>";
+      else
+        {
+          res << ">" + old_sanitize(this->inner);
+          for (const auto& child: this->children)
+            res << child.to_string();
+          res << "</" << this->name << ">";
+        }
+      res << old_sanitize(this->tail);
+      return res.str();
+    }
+
+    XmlNode to_xml() const
+    {
+      XmlNode node(this->name);
+      for (const auto& it: this->attributes)
+        node[it.first] = it.second;
+      node.set_inner(this->inner);
+      for (const auto& child: this->children)
+        node.add_child(child.to_xml());
+      node.set_tail(this->tail);
+      return node;
+    }
+  };
+
+  Node muc_message(const std::string& body)
+  {
+    return {"message", {{"from", "#biboumi%irc.example.com@biboumi.example.com/louiz"},
+                        {"to", "someone@example.com/resource"}, {"type", "groupchat"},
+                        {"id", "dd2ab4a4-b2bd-4e8f-a1e3-e77da4fb6ba8"}}, "",
+            {{"body", {}, body, {}, ""},
+             {"stanza-id", {{"xmlns", "urn:xmpp:sid:0"}, {"by", "#biboumi%irc.example.com@biboumi.example.com"},
+                            {"id", "8bdcdb2c-34b8-4ce0-b3a5-b4a4c8e5d4a6"}}, "", {}, ""}}, ""};
+  }
+
+  Node muc_presence(const std::string& nick)
+  {
+    return {"presence", {{"from", "#biboumi%irc.example.com@biboumi.example.com/" + nick},
+                         {"to", "someone@example.com/resource"}}, "",
+            {{"x", {{"xmlns", "http://jabber.org/protocol/muc#user"}}, "",
+              {{"item", {{"affiliation", "member"}, {"role", "participant"}}, "", {}, ""}}, ""}}, ""};
+  }
+}
+
+TEST_CASE("XmlNode serialization")
+{
+  const std::vector<std::string> texts = {
+    "",
+    "coucou",
+    R"('coucou'<cc>/&"gaga")",
+    "tab\tnew line\r\n, and a bell\a and an escape\x1B",
+    "\xC3\xA9t\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80",
+    // Not allowed in XML: a surrogate, U+FFFE and a codepoint too big
+    "a\xED\xA0\x80" "b\xEF\xBF\xBE" "c\xF7\xBF\xBF\xBF" "d",
+    // Not UTF-8, converted from latin-1
+    "\xE9t\xE9 & <hiver>",
+    // Truncated codepoints
+    "abc\xC3",
+    "abc\xE2\x82",
+    std::string("before\0after", 12),
+  };
+  for (const auto& text: texts)
+    {
+      Node node = muc_message(text);
+      node.attributes["id"] = text;
+      node.inner = text;
+      node.children[1].tail = text;
+      const auto xml = node.to_xml();
+      CHECK(xml.to_string() == node.to_string());
+
+      std::string res = "prefix";
+      xml.serialize(res);
+      CHECK(res == "prefix" + node.to_string());
+    }
+
+  CHECK(Stanza("a").to_string() == "<a/>");
+  Stanza message("message");
+  message["to"] = "a'b";
+  message.set_inner("<&>");
+  XmlSubNode(message, "body").set_tail("tail");
+  CHECK(message.to_string() == "<message to='a&apos;b'>&lt;&amp;&gt;<body/>tail</message>");
+}
+
+TEST_CASE("XmlNode serialization around an attribute")
+{
+  auto message = muc_message("Hello <everyone>").to_xml();
+  message.add_child(muc_presence("nick").to_xml());
+  message["to"] = "";
+  std::string before = "a";
+  std::string after = "b";
+  message.serialize_around("to", before, after);
+  CHECK(before.substr(0, 9) == "a<message");
+  CHECK(after.substr(0, 3) == "b' ");
+  for (const std::string jid: {"someone@example.com/resource", "someone@example.com/it's"})
+    {
+      message["to"] = jid;
+      CHECK(before + sanitize(jid) + after.substr(1) == "a" + message.to_string());
+    }
+
+  Stanza iq("iq");
+  before.clear();
+  after.clear();
+  iq.serialize_around("to", before, after);
+  CHECK(before == "<iq/>");
+  CHECK(after.empty());
+}
+
+namespace
+{
+  /**
+   * A component already connected to one end of a socketpair
+   */
+  class ConnectedComponent: public BiboumiComponent
+  {
+  public:
+    ConnectedComponent(std::shared_ptr<Poller>& poller, const int socket):
+      BiboumiComponent(poller, "biboumi.localhost", "secret")
+    {
+      this->socket = socket;
+      this->add_to_poller();
+    }
+    bool is_connected() const override
+    { return true; }
+  };
+}
+
+TEST_CASE("MUC message sent to several resources")
+{
+#ifdef USE_DATABASE
+  Database::open(":memory:");
+#endif
+  auto poller = std::make_shared<Poller>();
+  int sv[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  {
+    ConnectedComponent xmpp(poller, sv[0]);
+    Bridge bridge("user@localhost", xmpp, poller);
+    const Iid iid("#chan", "irc.localhost", Iid::Type::Channel);
+    bridge.resources_in_chan[iid.to_tuple()] = {"a", "b", "it's"};
+
+    bridge.send_message(iid, "nick", "hello", true, false);
+    for (int i = 0; i < 10 && xmpp.get_output_size() > 0; ++i)
+      poller->poll(100ms);
+    REQUIRE(xmpp.get_output_size() == 0);
+
+    std::string received = "<stream xmlns='jabber:component:accept'>";
+    char buf[4096];
+    ssize_t size;
+    while ((size = ::recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+      received.append(buf, static_cast<std::size_t>(size));
+
+    std::vector<std::string> recipients;
+    std::vector<std::string> ids;
+    XmppParser xml;
+    xml.add_stanza_callback([&recipients, &ids](const Stanza& stanza)
+        {
+          CHECK(stanza.get_tag("from") == "#chan%irc.localhost@biboumi.localhost/nick");
+          recipients.push_back(stanza.get_tag("to"));
+          ids.push_back(stanza.get_tag("id"));
+        });
+    xml.feed(received.data(), static_cast<int>(received.size()), false);
+
+    // Every copy is identical, apart from its recipient
+    CHECK(recipients == std::vector<std::string>{"user@localhost/a", "user@localhost/b", "user@localhost/it's"});
+    REQUIRE(ids.size() == 3);
+    CHECK_FALSE(ids[0].empty());
+    CHECK(ids[1] == ids[0]);
+    CHECK(ids[2] == ids[0]);
+  }
+  ::close(sv[1]);
+#ifdef USE_DATABASE
+  Database::close();
+#endif
+}
+
+TEST_CASE("XmlNode serialization benchmark", "[.benchmark]")
+{
+  constexpr int number = 100000;
+  const std::vector<XmlNode> stanzas = {
+    muc_message("Hello, everyone. Did you read the <last> log of the meeting? It’s at https://example.com/log?a=1&b=2").to_xml(),
+    muc_message("ok").to_xml(),
+    muc_presence("louiz").to_xml(),
+    muc_presence("someone-else").to_xml(),
+  };
+
+  const auto measure = [](auto&& function) {
+    const auto begin = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+  };
+
+  std::size_t size = 0;
+  const auto old_duration = measure([&]() {
+      const std::vector<Node> nodes = {
+        muc_message("Hello, everyone. Did you read the <last> log of the meeting? It’s at https://example.com/log?a=1&b=2"),
+        muc_message("ok"),
+        muc_presence("louiz"),
+        muc_presence("someone-else"),
+      };
+      for (int i = 0; i < number; ++i)
+        size += nodes[static_cast<std::size_t>(i) % nodes.size()].to_string().size();
+    });
+  const auto to_string_duration = measure([&]() {
+      for (int i = 0; i < number; ++i)
+        size -= stanzas[static_cast<std::size_t>(i) % stanzas.size()].to_string().size();
+    });
+  CHECK(size == 0);
+  std::string buffer;
+  const auto serialize_duration = measure([&]() {
+      for (int i = 0; i < number; ++i)
+        {
+          buffer.clear();
+          stanzas[static_cast<std::size_t>(i) % stanzas.size()].serialize(buffer);
+          size += buffer.size();
+        }
+    });
+  CHECK(size > 0);
+
+  WARN(number << " stanzas, ostringstream and sanitize: " << old_duration.count() << "ms");
+  WARN(number << " stanzas, to_string: " << to_string_duration.count() << "ms");
+  WARN(number << " stanzas, serialize in a reused string: " << serialize_duration.count() << "ms");
+}